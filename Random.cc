@@ -1,6 +1,27 @@
+#define REDISMODULE_EXPERIMENTAL_API
 #include "redismodule.h"
 #include <random>
 #include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <strings.h>
+#include <charconv>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 
 extern "C" {
 //  int RandomUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
@@ -14,357 +35,6408 @@ extern "C" {
 std::random_device rd;
 std::mt19937 gen(rd());
 
-/* RANDOM.DUNIF START END */
+/* Engines
+ * All engines produce 64-bit words. Words are handed out from a buffer that
+ * is refilled in bulk by fill(), which is where the batched and SIMD
+ * generators live, so every consumer benefits from them: the std
+ * distributions call the engine as a UniformRandomBitGenerator and bulk
+ * consumers take whole arrays with words(). fill() is always asked for a
+ * multiple of ENGINE_BLOCK words, so multi-lane engines step all their
+ * lanes together and give the same sequence with or without SIMD. */
+#define ENGINE_BUFFER 256
+#define ENGINE_BLOCK 8
+
+struct Engine {
+  typedef uint64_t result_type;
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return UINT64_MAX; }
+
+  const char *name;
+  uint64_t buf[ENGINE_BUFFER];
+  size_t pos;
+
+  Engine(const char *name) : name(name), pos(ENGINE_BUFFER) {}
+  virtual ~Engine() {}
+  virtual void seed(uint64_t s) = 0;
+  virtual void fill(uint64_t *out, size_t n) = 0;
+
+  /* Starts the sequence over from seed s */
+  void reseed(uint64_t s) {
+    seed(s);
+    pos = ENGINE_BUFFER;
+  }
+
+  result_type operator()() {
+    if (pos == ENGINE_BUFFER)
+    {
+      fill(buf,ENGINE_BUFFER);
+      pos = 0;
+    }
+    return buf[pos++];
+  }
+
+  /* Same words operator() would return, n at a time */
+  void words(uint64_t *out, size_t n) {
+    while (n > 0 && pos < ENGINE_BUFFER)
+    {
+      *out++ = buf[pos++];
+      n--;
+    }
+    size_t bulk = n - n % ENGINE_BUFFER;
+    if (bulk)
+    {
+      fill(out,bulk);
+      out += bulk;
+      n -= bulk;
+    }
+    while (n-- > 0) *out++ = (*this)();
+  }
+};
+
+/* SplitMix64, to expand a 64-bit seed into engine state */
+inline uint64_t SplitMix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+inline uint64_t Rotl64(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+static int HaveAVX2;
+#endif
+
+/* The shared std::mt19937, two 32-bit outputs per word */
+struct MT19937Engine : Engine {
+  std::mt19937 &mt;
+  MT19937Engine(std::mt19937 &mt) : Engine("mt19937"), mt(mt) {}
+  void seed(uint64_t s) {
+    std::seed_seq seq{(uint32_t) s, (uint32_t) (s >> 32)};
+    mt.seed(seq);
+  }
+  void fill(uint64_t *out, size_t n) {
+    for (size_t i=0; i < n; i++)
+    {
+      uint64_t hi = mt();
+      out[i] = (hi << 32) | mt();
+    }
+  }
+};
+
+/* xoshiro256** run as four interleaved streams, word i coming from stream
+ * i%4, which maps onto one AVX2 register per state word */
+struct XoshiroEngine : Engine {
+  uint64_t s[4][4];   /* s[word][stream] */
+  XoshiroEngine() : Engine("xoshiro256") {}
+  void seed(uint64_t x) {
+    for (int l=0; l < 4; l++)
+      for (int w=0; w < 4; w++)
+        s[w][l] = SplitMix64(&x);
+  }
+  void fill(uint64_t *out, size_t n);
+};
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+void XoshiroFillAVX2(uint64_t s[4][4], uint64_t *out, size_t n) {
+  __m256i s0 = _mm256_loadu_si256((__m256i *) s[0]);
+  __m256i s1 = _mm256_loadu_si256((__m256i *) s[1]);
+  __m256i s2 = _mm256_loadu_si256((__m256i *) s[2]);
+  __m256i s3 = _mm256_loadu_si256((__m256i *) s[3]);
+  for (size_t i=0; i < n; i += 4)
+  {
+    __m256i x = _mm256_add_epi64(_mm256_slli_epi64(s1,2),s1);          /* s1*5 */
+    x = _mm256_or_si256(_mm256_slli_epi64(x,7),_mm256_srli_epi64(x,57));
+    x = _mm256_add_epi64(_mm256_slli_epi64(x,3),x);                    /* *9 */
+    _mm256_storeu_si256((__m256i *) (out+i),x);
+    __m256i t = _mm256_slli_epi64(s1,17);
+    s2 = _mm256_xor_si256(s2,s0);
+    s3 = _mm256_xor_si256(s3,s1);
+    s1 = _mm256_xor_si256(s1,s2);
+    s0 = _mm256_xor_si256(s0,s3);
+    s2 = _mm256_xor_si256(s2,t);
+    s3 = _mm256_or_si256(_mm256_slli_epi64(s3,45),_mm256_srli_epi64(s3,19));
+  }
+  _mm256_storeu_si256((__m256i *) s[0],s0);
+  _mm256_storeu_si256((__m256i *) s[1],s1);
+  _mm256_storeu_si256((__m256i *) s[2],s2);
+  _mm256_storeu_si256((__m256i *) s[3],s3);
+}
+#endif
+
+void XoshiroEngine::fill(uint64_t *out, size_t n) {
+#ifdef HAVE_X86_SIMD
+  if (HaveAVX2) return XoshiroFillAVX2(s,out,n);
+#endif
+  for (size_t i=0; i < n; i += 4)
+    for (int l=0; l < 4; l++)
+    {
+      out[i+l] = Rotl64(s[1][l]*5,7)*9;
+      uint64_t t = s[1][l] << 17;
+      s[2][l] ^= s[0][l];
+      s[3][l] ^= s[1][l];
+      s[1][l] ^= s[2][l];
+      s[0][l] ^= s[3][l];
+      s[2][l] ^= t;
+      s[3][l] = Rotl64(s[3][l],45);
+    }
+}
+
+/* PCG64: 128-bit LCG with the XSL RR output function */
+struct PCG64Engine : Engine {
+  __uint128_t state, inc;
+  PCG64Engine() : Engine("pcg64") {}
+  void seed(uint64_t x) {
+    uint64_t a = SplitMix64(&x), b = SplitMix64(&x), c = SplitMix64(&x), d = SplitMix64(&x);
+    inc = ((((__uint128_t) c) << 64) | d) | 1;
+    state = 0;
+    step();
+    state += (((__uint128_t) a) << 64) | b;
+    step();
+  }
+  void step() {
+    const __uint128_t mult = (((__uint128_t) 0x2360ED051FC65DA4ULL) << 64) | 0x4385DF649FCCF645ULL;
+    state = state*mult + inc;
+  }
+  void fill(uint64_t *out, size_t n) {
+    for (size_t i=0; i < n; i++)
+    {
+      step();
+      uint64_t x = (uint64_t) (state >> 64) ^ (uint64_t) state;
+      int rot = state >> 122;
+      out[i] = (x >> rot) | (x << ((-rot) & 63));
+    }
+  }
+};
+
+/* Philox4x32-10, counter based: block i of a stream is a pure function of
+ * the key and the counter i, two words per block */
+#define PHILOX_M0 0xD2511F53U
+#define PHILOX_M1 0xCD9E8D57U
+#define PHILOX_W0 0x9E3779B9U
+#define PHILOX_W1 0xBB67AE85U
+
+inline void Philox4x32(const uint32_t ctr[4], const uint32_t key[2], uint32_t out[4]) {
+  uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for (int r=0; r < 10; r++)
+  {
+    uint64_t p0 = (uint64_t) PHILOX_M0 * c0;
+    uint64_t p1 = (uint64_t) PHILOX_M1 * c2;
+    uint32_t n0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+    uint32_t n2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+    c1 = (uint32_t) p1;
+    c3 = (uint32_t) p0;
+    c0 = n0;
+    c2 = n2;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+struct PhiloxEngine : Engine {
+  uint32_t key[2];
+  uint64_t ctr;   /* low half of the 128-bit counter */
+  uint64_t hi;    /* high half, the stream, 0 unless chosen */
+  PhiloxEngine() : Engine("philox") {}
+  void seed(uint64_t x) {
+    uint64_t k = SplitMix64(&x);
+    key[0] = (uint32_t) k;
+    key[1] = (uint32_t) (k >> 32);
+    ctr = 0;
+    hi = 0;
+  }
+  /* Starts over on stream s of the same key, a sequence of its own */
+  void stream(uint64_t s) {
+    hi = s;
+    ctr = 0;
+    pos = ENGINE_BUFFER;
+  }
+  void fill(uint64_t *out, size_t n);
+};
+
+#ifdef HAVE_X86_SIMD
+/* Four blocks at a time, one 32-bit counter word per 64-bit lane so that
+ * _mm256_mul_epu32 gives the full products */
+__attribute__((target("avx2")))
+void PhiloxFillAVX2(const uint32_t key[2], uint64_t ctr, uint64_t hi, uint64_t *out, size_t n) {
+  const __m256i lo32 = _mm256_set1_epi64x(0xFFFFFFFFULL);
+  const __m256i m0 = _mm256_set1_epi64x(PHILOX_M0);
+  const __m256i m1 = _mm256_set1_epi64x(PHILOX_M1);
+  for (size_t i=0; i < n; i += 8, ctr += 4)
+  {
+    __m256i c0 = _mm256_set_epi64x((uint32_t) (ctr+3),(uint32_t) (ctr+2),(uint32_t) (ctr+1),(uint32_t) ctr);
+    __m256i c1 = _mm256_set_epi64x((ctr+3) >> 32,(ctr+2) >> 32,(ctr+1) >> 32,ctr >> 32);
+    __m256i c2 = _mm256_set1_epi64x((uint32_t) hi);
+    __m256i c3 = _mm256_set1_epi64x(hi >> 32);
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r=0; r < 10; r++)
+    {
+      __m256i p0 = _mm256_mul_epu32(c0,m0);
+      __m256i p1 = _mm256_mul_epu32(c2,m1);
+      __m256i n0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1,32),c1),_mm256_set1_epi64x(k0));
+      __m256i n2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0,32),c3),_mm256_set1_epi64x(k1));
+      c1 = _mm256_and_si256(p1,lo32);
+      c3 = _mm256_and_si256(p0,lo32);
+      c0 = n0;
+      c2 = n2;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+    /* words are (c1,c0) and (c3,c2) per block, blocks in counter order */
+    __m256i w0 = _mm256_or_si256(_mm256_slli_epi64(c1,32),c0);
+    __m256i w1 = _mm256_or_si256(_mm256_slli_epi64(c3,32),c2);
+    __m256i a = _mm256_unpacklo_epi64(w0,w1);   /* blocks 0,2 */
+    __m256i b = _mm256_unpackhi_epi64(w0,w1);   /* blocks 1,3 */
+    _mm256_storeu_si256((__m256i *) (out+i),_mm256_permute2x128_si256(a,b,0x20));
+    _mm256_storeu_si256((__m256i *) (out+i+4),_mm256_permute2x128_si256(a,b,0x31));
+  }
+}
+#endif
+
+void PhiloxEngine::fill(uint64_t *out, size_t n) {
+#ifdef HAVE_X86_SIMD
+  if (HaveAVX2)
+  {
+    PhiloxFillAVX2(key,ctr,hi,out,n);
+    ctr += n/2;
+    return;
+  }
+#endif
+  for (size_t i=0; i < n; i += 2, ctr++)
+  {
+    uint32_t c[4] = {(uint32_t) ctr, (uint32_t) (ctr >> 32), (uint32_t) hi, (uint32_t) (hi >> 32)}, r[4];
+    Philox4x32(c,key,r);
+    out[i] = ((uint64_t) r[1] << 32) | r[0];
+    out[i+1] = ((uint64_t) r[3] << 32) | r[2];
+  }
+}
+
+/* ChaCha20, with a 64-bit block counter and a 64-bit nonce as in the
+ * original design. Each block is 16 words of 32 bits, 8 engine words, and
+ * the keystream is a CSPRNG: its outputs tell nothing of the key or of the
+ * outputs before them. */
+#define CHACHA_C0 0x61707865U
+#define CHACHA_C1 0x3320646eU
+#define CHACHA_C2 0x79622d32U
+#define CHACHA_C3 0x6b206574U
+
+inline uint32_t Rotl32(uint32_t x, int k) {
+  return (x << k) | (x >> (32 - k));
+}
+
+#define CHACHA_QR(a,b,c,d) \
+  a += b; d ^= a; d = Rotl32(d,16); \
+  c += d; b ^= c; b = Rotl32(b,12); \
+  a += b; d ^= a; d = Rotl32(d,8); \
+  c += d; b ^= c; b = Rotl32(b,7);
+
+void ChaCha20Block(const uint32_t in[16], uint32_t out[16]) {
+  uint32_t x[16];
+  memcpy(x,in,sizeof(x));
+  for (int r=0; r < 10; r++)
+  {
+    CHACHA_QR(x[0],x[4],x[8],x[12]);
+    CHACHA_QR(x[1],x[5],x[9],x[13]);
+    CHACHA_QR(x[2],x[6],x[10],x[14]);
+    CHACHA_QR(x[3],x[7],x[11],x[15]);
+    CHACHA_QR(x[0],x[5],x[10],x[15]);
+    CHACHA_QR(x[1],x[6],x[11],x[12]);
+    CHACHA_QR(x[2],x[7],x[8],x[13]);
+    CHACHA_QR(x[3],x[4],x[9],x[14]);
+  }
+  for (int i=0; i < 16; i++) out[i] = x[i]+in[i];
+}
+
+struct ChaChaEngine : Engine {
+  uint32_t key[8];
+  uint64_t ctr;     /* block counter */
+  uint64_t nonce;
+  ChaChaEngine() : Engine("chacha20") {}
+  void seed(uint64_t x) {
+    for (int i=0; i < 8; i += 2)
+    {
+      uint64_t k = SplitMix64(&x);
+      key[i] = (uint32_t) k;
+      key[i+1] = (uint32_t) (k >> 32);
+    }
+    ctr = 0;
+    nonce = 0;
+  }
+  /* Starts over from a full 256-bit key */
+  void rekey(const uint32_t k[8]) {
+    memcpy(key,k,sizeof(key));
+    ctr = 0;
+    nonce = 0;
+    pos = ENGINE_BUFFER;
+  }
+  void fill(uint64_t *out, size_t n);
+};
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+inline __m256i ChaChaRotl(__m256i x, int k) {
+  return _mm256_or_si256(_mm256_slli_epi32(x,k),_mm256_srli_epi32(x,32-k));
+}
+
+/* Transposes the 8x8 words of a, lane i of every a[j] going to row i */
+__attribute__((target("avx2")))
+inline void ChaChaTranspose(__m256i a[8]) {
+  __m256i t[8], u[8];
+  for (int j=0; j < 8; j += 2)
+  {
+    t[j] = _mm256_unpacklo_epi32(a[j],a[j+1]);
+    t[j+1] = _mm256_unpackhi_epi32(a[j],a[j+1]);
+  }
+  for (int j=0; j < 8; j += 4)
+  {
+    u[j] = _mm256_unpacklo_epi64(t[j],t[j+2]);
+    u[j+1] = _mm256_unpackhi_epi64(t[j],t[j+2]);
+    u[j+2] = _mm256_unpacklo_epi64(t[j+1],t[j+3]);
+    u[j+3] = _mm256_unpackhi_epi64(t[j+1],t[j+3]);
+  }
+  for (int j=0; j < 4; j++)
+  {
+    a[j] = _mm256_permute2x128_si256(u[j],u[j+4],0x20);
+    a[j+4] = _mm256_permute2x128_si256(u[j],u[j+4],0x31);
+  }
+}
+
+#define CHACHA_QR8(a,b,c,d) \
+  a = _mm256_add_epi32(a,b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d,a),rot16); \
+  c = _mm256_add_epi32(c,d); b = ChaChaRotl(_mm256_xor_si256(b,c),12); \
+  a = _mm256_add_epi32(a,b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d,a),rot8); \
+  c = _mm256_add_epi32(c,d); b = ChaChaRotl(_mm256_xor_si256(b,c),7);
+
+/* Eight blocks at a time, state word j of block i in lane i of x[j] */
+__attribute__((target("avx2")))
+void ChaChaFillAVX2(const uint32_t key[8], uint64_t ctr, uint64_t nonce, uint64_t *out, size_t n) {
+  const __m256i rot16 = _mm256_setr_epi8(2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13,
+                                         2,3,0,1,6,7,4,5,10,11,8,9,14,15,12,13);
+  const __m256i rot8 = _mm256_setr_epi8(3,0,1,2,7,4,5,6,11,8,9,10,15,12,13,14,
+                                        3,0,1,2,7,4,5,6,11,8,9,10,15,12,13,14);
+  __m256i in[16];
+  in[0] = _mm256_set1_epi32(CHACHA_C0);
+  in[1] = _mm256_set1_epi32(CHACHA_C1);
+  in[2] = _mm256_set1_epi32(CHACHA_C2);
+  in[3] = _mm256_set1_epi32(CHACHA_C3);
+  for (int j=0; j < 8; j++) in[4+j] = _mm256_set1_epi32(key[j]);
+  in[14] = _mm256_set1_epi32((uint32_t) nonce);
+  in[15] = _mm256_set1_epi32(nonce >> 32);
+  for (size_t i=0; i < n; i += 64, ctr += 8)
+  {
+    uint32_t lo[8], hi[8];
+    for (int b=0; b < 8; b++)
+    {
+      lo[b] = (uint32_t) (ctr+b);
+      hi[b] = (ctr+b) >> 32;
+    }
+    in[12] = _mm256_loadu_si256((const __m256i *) lo);
+    in[13] = _mm256_loadu_si256((const __m256i *) hi);
+    __m256i x[16];
+    for (int j=0; j < 16; j++) x[j] = in[j];
+    for (int r=0; r < 10; r++)
+    {
+      CHACHA_QR8(x[0],x[4],x[8],x[12]);
+      CHACHA_QR8(x[1],x[5],x[9],x[13]);
+      CHACHA_QR8(x[2],x[6],x[10],x[14]);
+      CHACHA_QR8(x[3],x[7],x[11],x[15]);
+      CHACHA_QR8(x[0],x[5],x[10],x[15]);
+      CHACHA_QR8(x[1],x[6],x[11],x[12]);
+      CHACHA_QR8(x[2],x[7],x[8],x[13]);
+      CHACHA_QR8(x[3],x[4],x[9],x[14]);
+    }
+    for (int j=0; j < 16; j++) x[j] = _mm256_add_epi32(x[j],in[j]);
+    /* Rows of the two transposes are the halves of blocks 0..7 */
+    ChaChaTranspose(x);
+    ChaChaTranspose(x+8);
+    __m256i *dst = (__m256i *) (out+i);
+    for (int b=0; b < 8; b++)
+    {
+      _mm256_storeu_si256(dst+2*b,x[b]);
+      _mm256_storeu_si256(dst+2*b+1,x[8+b]);
+    }
+  }
+}
+#endif
+
+void ChaChaEngine::fill(uint64_t *out, size_t n) {
+#ifdef HAVE_X86_SIMD
+  size_t bulk = n - n % 64;
+  if (HaveAVX2 && bulk)
+  {
+    ChaChaFillAVX2(key,ctr,nonce,out,bulk);
+    ctr += bulk/8;
+    out += bulk;
+    n -= bulk;
+  }
+#endif
+  uint32_t in[16] = {CHACHA_C0, CHACHA_C1, CHACHA_C2, CHACHA_C3};
+  memcpy(in+4,key,sizeof(key));
+  in[14] = (uint32_t) nonce;
+  in[15] = nonce >> 32;
+  for (size_t i=0; i < n; i += 8, ctr++)
+  {
+    uint32_t x[16];
+    in[12] = (uint32_t) ctr;
+    in[13] = ctr >> 32;
+    ChaCha20Block(in,x);
+    for (int j=0; j < 8; j++)
+      out[i+j] = ((uint64_t) x[2*j+1] << 32) | x[2*j];
+  }
+}
+
+MT19937Engine mtEngine(gen);
+XoshiroEngine xoshiroEngine;
+PCG64Engine pcgEngine;
+PhiloxEngine philoxEngine;
+ChaChaEngine chachaEngine;
+
+Engine *Engines[] = {&mtEngine, &xoshiroEngine, &pcgEngine, &philoxEngine, &chachaEngine};
+
+/* Engine used by commands without an ENGINE option, set at module load */
+Engine *defaultEngine = &mtEngine;
+
+Engine *EngineByName(const char *name) {
+  for (size_t i=0; i < sizeof(Engines)/sizeof(Engines[0]); i++)
+    if (!strcasecmp(name,Engines[i]->name)) return Engines[i];
+  return NULL;
+}
+
+size_t EngineIndex(Engine *eng) {
+  return std::find(std::begin(Engines),std::end(Engines),eng) - std::begin(Engines);
+}
+
+/* A private engine of each kind, for code that must not draw from or
+ * disturb the shared ones */
+struct EngineSet {
+  std::mt19937 mt;
+  MT19937Engine mtEngine;
+  XoshiroEngine xoshiroEngine;
+  PCG64Engine pcgEngine;
+  PhiloxEngine philoxEngine;
+  ChaChaEngine chachaEngine;
+  Engine *engines[5];   /* in the order of Engines */
+  EngineSet() : mtEngine(mt),
+    engines{&mtEngine, &xoshiroEngine, &pcgEngine, &philoxEngine, &chachaEngine} {}
+};
+
+/* Reseeded by each l* command, see SampleSinkRun */
+EngineSet seededEngines;
+
+/* A double in [0,1) from the top 53 bits of a word */
+inline double WordToUnit(uint64_t w) {
+  return (w >> 11) * 0x1.0p-53;
+}
+
+/* Ziggurat samplers (Marsaglia & Tsang, 256 layers). Layer 0 is the base
+ * strip with the tail, and a sample is almost always one word: 8 bits
+ * pick the layer and the rest give the abscissa, accepted at once when it
+ * falls inside the next layer. The tables are built by ZigguratInit at
+ * module load. */
+#define ZIG_NORM_R 3.6541528853610088
+#define ZIG_NORM_V 0.00492867323399
+#define ZIG_EXP_R 7.69711747013104972
+#define ZIG_EXP_V 0.0039496598225815571993
+
+uint64_t zigNormK[256], zigExpK[256];
+double zigNormW[256], zigNormF[256];
+double zigExpW[256], zigExpF[256];
+
+void ZigguratInit() {
+  /* Normal, 53-bit abscissas */
+  const double m1 = 9007199254740992.0;   /* 2^53 */
+  double dn = ZIG_NORM_R, tn = dn;
+  double q = ZIG_NORM_V/exp(-0.5*dn*dn);
+  zigNormK[0] = (uint64_t) ((dn/q)*m1);
+  zigNormK[1] = 0;
+  zigNormW[0] = q/m1;
+  zigNormW[255] = dn/m1;
+  zigNormF[0] = 1.0;
+  zigNormF[255] = exp(-0.5*dn*dn);
+  for (int i=254; i >= 1; i--)
+  {
+    dn = sqrt(-2.0*log(ZIG_NORM_V/dn + exp(-0.5*dn*dn)));
+    zigNormK[i+1] = (uint64_t) ((dn/tn)*m1);
+    tn = dn;
+    zigNormF[i] = exp(-0.5*dn*dn);
+    zigNormW[i] = dn/m1;
+  }
+
+  /* Exponential, 56-bit abscissas */
+  const double m2 = 72057594037927936.0;  /* 2^56 */
+  double de = ZIG_EXP_R, te = de;
+  q = ZIG_EXP_V/exp(-de);
+  zigExpK[0] = (uint64_t) ((de/q)*m2);
+  zigExpK[1] = 0;
+  zigExpW[0] = q/m2;
+  zigExpW[255] = de/m2;
+  zigExpF[0] = 1.0;
+  zigExpF[255] = exp(-de);
+  for (int i=254; i >= 1; i--)
+  {
+    de = -log(ZIG_EXP_V/de + exp(-de));
+    zigExpK[i+1] = (uint64_t) ((de/te)*m2);
+    te = de;
+    zigExpF[i] = exp(-de);
+    zigExpW[i] = de/m2;
+  }
+}
+
+/* Standard normal from word w, drawing more words only when rejected */
+inline double ZigNormal(Engine &eng, uint64_t w) {
+  for (;;)
+  {
+    int i = w & 0xff;
+    uint64_t m = (w >> 9) & ((1ULL << 53) - 1);
+    double x = m*zigNormW[i];
+    /* Sign from bit 8, without a branch */
+    uint64_t bits;
+    memcpy(&bits,&x,sizeof(bits));
+    bits ^= (w & 0x100) << 55;
+    memcpy(&x,&bits,sizeof(x));
+    if (m < zigNormK[i]) return x;
+    if (i == 0)
+    {
+      /* Tail beyond R */
+      for (;;)
+      {
+        double xx = -log1p(-WordToUnit(eng()))/ZIG_NORM_R;
+        double yy = -log1p(-WordToUnit(eng()));
+        if (yy+yy > xx*xx)
+          return (w & 0x100) ? -(ZIG_NORM_R+xx) : ZIG_NORM_R+xx;
+      }
+    }
+    if (zigNormF[i] + WordToUnit(eng())*(zigNormF[i-1]-zigNormF[i]) < exp(-0.5*x*x))
+      return x;
+    w = eng();
+  }
+}
+
+/* Standard exponential from word w */
+inline double ZigExp(Engine &eng, uint64_t w) {
+  for (;;)
+  {
+    int i = w & 0xff;
+    uint64_t m = w >> 8;
+    double x = m*zigExpW[i];
+    if (m < zigExpK[i]) return x;
+    if (i == 0)
+      return ZIG_EXP_R - log1p(-WordToUnit(eng()));
+    if (zigExpF[i] + WordToUnit(eng())*(zigExpF[i-1]-zigExpF[i]) < exp(-x))
+      return x;
+    w = eng();
+  }
+}
+
+/* Normal doubles with mean and standard deviation sd */
+void NormalFill(Engine &eng, double *out, size_t n, double mean, double sd) {
+  uint64_t w[ENGINE_BUFFER];
+  while (n > 0)
+  {
+    size_t m = n < ENGINE_BUFFER ? n : ENGINE_BUFFER;
+    eng.words(w,m);
+    for (size_t i=0; i < m; i++)
+      out[i] = mean + sd*ZigNormal(eng,w[i]);
+    out += m;
+    n -= m;
+  }
+}
+
+/* Exponential doubles with rate lambda */
+void ExpFill(Engine &eng, double *out, size_t n, double lambda) {
+  uint64_t w[ENGINE_BUFFER];
+  double scale = 1.0/lambda;
+  while (n > 0)
+  {
+    size_t m = n < ENGINE_BUFFER ? n : ENGINE_BUFFER;
+    eng.words(w,m);
+    for (size_t i=0; i < m; i++)
+      out[i] = scale*ZigExp(eng,w[i]);
+    out += m;
+    n -= m;
+  }
+}
+
+/* Uniform doubles in [a,b), from bulks of words */
+void UniformFill(Engine &eng, double *out, size_t n, double a, double b) {
+  uint64_t w[ENGINE_BUFFER];
+  double range = b-a;
+  while (n > 0)
+  {
+    size_t m = n < ENGINE_BUFFER ? n : ENGINE_BUFFER;
+    eng.words(w,m);
+    for (size_t i=0; i < m; i++)
+      out[i] = a + range*WordToUnit(w[i]);
+    out += m;
+    n -= m;
+  }
+}
+
+/* Uniform integer in [0,range), with range 0 standing for 2^64, from word
+ * w by Lemire's nearly divisionless method: the high word of w*range,
+ * unless the low word falls in the few values that would bias it, which
+ * takes a division and more words only then */
+inline uint64_t BoundedWord(Engine &eng, uint64_t w, uint64_t range) {
+  if (range == 0) return w;
+  unsigned __int128 m = (unsigned __int128) w * range;
+  uint64_t l = (uint64_t) m;
+  if (l < range)
+  {
+    uint64_t t = -range % range;
+    while (l < t)
+    {
+      m = (unsigned __int128) eng() * range;
+      l = (uint64_t) m;
+    }
+  }
+  return m >> 64;
+}
+
+/* Fills out with uniform integers in [start,start+range) */
+template <class T>
+void DUnifFill(Engine &eng, T *out, size_t n, long long start, uint64_t range) {
+  uint64_t w[ENGINE_BUFFER];
+  while (n > 0)
+  {
+    size_t m = n < ENGINE_BUFFER ? n : ENGINE_BUFFER;
+    eng.words(w,m);
+    for (size_t i=0; i < m; i++)
+      out[i] = (T) (long long) ((uint64_t) start + BoundedWord(eng,w[i],range));
+    out += m;
+    n -= m;
+  }
+}
+
+/* Packed sample sets: a module data type holding samples as a contiguous
+ * array, instead of a list of one string per sample. The array is of
+ * doubles unless the set was made with another ENCODING: floats, or
+ * int16 or int32 fixed point numbers, a sample being the integer times
+ * the scale of the set. Samples are rounded to the encoding as they are
+ * added, and read back as doubles. */
+static RedisModuleType *SampleSetType;
+
+/* Version of the RDB format; version 0 had only doubles */
+#define SAMPLESET_ENCVER 1
+
+enum {
+  SAMPLE_TEXT = -1,   /* a list, not a sample set */
+  SAMPLE_F64,
+  SAMPLE_F32,
+  SAMPLE_I16,
+  SAMPLE_I32
+};
+
+static const char *SampleEncodings[] = {"float64","float32","int16","int32"};
+
+struct SampleSet {
+  size_t len;   /* samples stored */
+  size_t cap;   /* samples allocated */
+  int enc;      /* SAMPLE_F64 and on */
+  double scale; /* of the integer encodings */
+  void *v;
+};
+
+/* Samples per RDB string and per AOF command */
+#define SAMPLESET_CHUNK 4096
+
+/* Bytes a sample takes */
+inline size_t SampleWidth(int enc) {
+  return enc == SAMPLE_F64 ? 8 : enc == SAMPLE_I16 ? 2 : 4;
+}
+
+SampleSet *SampleSetCreate(int enc = SAMPLE_F64, double scale = 1) {
+  SampleSet *ss = (SampleSet *) RedisModule_Alloc(sizeof(SampleSet));
+  ss->len = ss->cap = 0;
+  ss->enc = enc;
+  ss->scale = enc == SAMPLE_I16 || enc == SAMPLE_I32 ? scale : 1;
+  ss->v = NULL;
+  return ss;
+}
+
+/* Make room for at least n samples in total */
+void SampleSetReserve(SampleSet *ss, size_t n) {
+  if (n <= ss->cap) return;
+  size_t cap = ss->cap ? ss->cap : 16;
+  while (cap < n) cap *= 2;
+  ss->v = RedisModule_Realloc(ss->v, cap*SampleWidth(ss->enc));
+  ss->cap = cap;
+}
+
+void SampleSetFree(void *value) {
+  SampleSet *ss = (SampleSet *) value;
+  RedisModule_Free(ss->v);
+  RedisModule_Free(ss);
+}
+
+/* Integer nearest x/scale, within the range of T */
+template <class T>
+inline T SampleFixed(double x, double scale) {
+  double q = std::nearbyint(x/scale);
+  if (q < std::numeric_limits<T>::min()) return std::numeric_limits<T>::min();
+  if (q > std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+  return q == q ? (T) q : 0;
+}
+
+/* Rounds n samples to what the set would keep of them */
+void SampleSetRound(const SampleSet *ss, double *v, size_t n) {
+  switch (ss->enc)
+  {
+  case SAMPLE_F32:
+    for (size_t i=0; i < n; i++) v[i] = (float) v[i];
+    break;
+  case SAMPLE_I16:
+    for (size_t i=0; i < n; i++) v[i] = SampleFixed<int16_t>(v[i],ss->scale)*ss->scale;
+    break;
+  case SAMPLE_I32:
+    for (size_t i=0; i < n; i++) v[i] = SampleFixed<int32_t>(v[i],ss->scale)*ss->scale;
+    break;
+  }
+}
+
+/* Appends n samples, with room for them reserved */
+void SampleSetAppend(SampleSet *ss, const double *v, size_t n) {
+  size_t len = ss->len;
+  switch (ss->enc)
+  {
+  case SAMPLE_F64:
+    memcpy((double *) ss->v+len,v,n*sizeof(double));
+    break;
+  case SAMPLE_F32:
+    for (size_t i=0; i < n; i++) ((float *) ss->v)[len+i] = v[i];
+    break;
+  case SAMPLE_I16:
+    for (size_t i=0; i < n; i++) ((int16_t *) ss->v)[len+i] = SampleFixed<int16_t>(v[i],ss->scale);
+    break;
+  case SAMPLE_I32:
+    for (size_t i=0; i < n; i++) ((int32_t *) ss->v)[len+i] = SampleFixed<int32_t>(v[i],ss->scale);
+    break;
+  }
+  ss->len += n;
+}
+
+/* Reads n samples from start on into out */
+void SampleSetRead(const SampleSet *ss, size_t start, double *out, size_t n) {
+  switch (ss->enc)
+  {
+  case SAMPLE_F64:
+    memcpy(out,(const double *) ss->v+start,n*sizeof(double));
+    break;
+  case SAMPLE_F32:
+    for (size_t i=0; i < n; i++) out[i] = ((const float *) ss->v)[start+i];
+    break;
+  case SAMPLE_I16:
+    for (size_t i=0; i < n; i++) out[i] = ((const int16_t *) ss->v)[start+i]*ss->scale;
+    break;
+  case SAMPLE_I32:
+    for (size_t i=0; i < n; i++) out[i] = ((const int32_t *) ss->v)[start+i]*ss->scale;
+    break;
+  }
+}
+
+inline double SampleSetGet(const SampleSet *ss, size_t i) {
+  double x;
+  SampleSetRead(ss,i,&x,1);
+  return x;
+}
+
+/* Calls f(v,n) over the samples, in place for doubles and otherwise read
+ * into doubles a chunk at a time */
+template <class F>
+void SampleSetScan(const SampleSet *ss, F f) {
+  if (ss->enc == SAMPLE_F64)
+  {
+    f((const double *) ss->v,ss->len);
+    return;
+  }
+  double buf[SAMPLESET_CHUNK];
+  for (size_t i=0; i < ss->len; i += SAMPLESET_CHUNK)
+  {
+    size_t n = std::min((size_t) SAMPLESET_CHUNK, ss->len-i);
+    SampleSetRead(ss,i,buf,n);
+    f((const double *) buf,n);
+  }
+}
+
+/* Serialized samples are little endian, IEEE 754 or two's complement */
+void PackWords(char *dst, const void *src, size_t n, size_t width) {
+  memcpy(dst,src,n*width);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (size_t i=0; i < n; i++, dst += width)
+    std::reverse(dst,dst+width);
+#endif
+}
+
+void PackSamples(char *dst, const double *src, size_t n) {
+  PackWords(dst,src,n,sizeof(double));
+}
+
+void UnpackSamples(double *dst, const char *src, size_t n) {
+  PackWords((char *) dst,src,n,sizeof(double));
+}
+
+/* Appends n samples serialized in the encoding enc, converted to the
+ * encoding of the set if it has another, with room for them reserved */
+void SampleSetUnpack(SampleSet *ss, const char *src, size_t n, int enc, double scale) {
+  size_t width = SampleWidth(enc);
+  if (enc == ss->enc && scale == ss->scale)
+  {
+    PackWords((char *) ss->v+ss->len*width,src,n,width);
+    ss->len += n;
+    return;
+  }
+  SampleSet *tmp = SampleSetCreate(enc,scale);
+  SampleSetReserve(tmp,n);
+  PackWords((char *) tmp->v,src,n,width);
+  tmp->len = n;
+  SampleSetScan(tmp, [&](const double *v, size_t m) {
+    SampleSetAppend(ss,v,m);
+  });
+  SampleSetFree(tmp);
+}
+
+void *SampleSetRdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver > SAMPLESET_ENCVER) return NULL;
+  uint64_t len = RedisModule_LoadUnsigned(rdb);
+  int enc = SAMPLE_F64;
+  double scale = 1;
+  if (encver >= 1)
+  {
+    uint64_t e = RedisModule_LoadUnsigned(rdb);
+    scale = RedisModule_LoadDouble(rdb);
+    if (e > SAMPLE_I32 || !(scale > 0))
+    {
+      RedisModule_LogIOError(rdb,"warning","Bad encoding of packed sample set");
+      return NULL;
+    }
+    enc = (int) e;
+  }
+  SampleSet *ss = SampleSetCreate(enc,scale);
+  SampleSetReserve(ss,len);
+  size_t width = SampleWidth(enc);
+  while (ss->len < len)
+  {
+    size_t blen;
+    char *buf = RedisModule_LoadStringBuffer(rdb,&blen);
+    size_t n = blen/width;
+    if (blen % width || n == 0 || n > len-ss->len)
+    {
+      RedisModule_LogIOError(rdb,"warning","Bad chunk in packed sample set");
+      RedisModule_Free(buf);
+      SampleSetFree(ss);
+      return NULL;
+    }
+    SampleSetUnpack(ss,buf,n,enc,ss->scale);
+    RedisModule_Free(buf);
+  }
+  return ss;
+}
+
+void SampleSetRdbSave(RedisModuleIO *rdb, void *value) {
+  SampleSet *ss = (SampleSet *) value;
+  size_t width = SampleWidth(ss->enc);
+  char buf[SAMPLESET_CHUNK*sizeof(double)];
+  RedisModule_SaveUnsigned(rdb,ss->len);
+  RedisModule_SaveUnsigned(rdb,ss->enc);
+  RedisModule_SaveDouble(rdb,ss->scale);
+  for (size_t i=0; i < ss->len; i += SAMPLESET_CHUNK)
+  {
+    size_t n = std::min((size_t) SAMPLESET_CHUNK, ss->len-i);
+    PackWords(buf,(const char *) ss->v+i*width,n,width);
+    RedisModule_SaveStringBuffer(rdb,buf,n*width);
+  }
+}
+
+/* Rewritten as a sequence of RANDOM.SLOAD commands with binary chunks,
+ * with the encoding given unless the samples are doubles */
+void SampleSetAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+  SampleSet *ss = (SampleSet *) value;
+  size_t width = SampleWidth(ss->enc);
+  char buf[SAMPLESET_CHUNK*sizeof(double)];
+  char scale[32];
+  *std::to_chars(scale,scale+sizeof(scale)-1,ss->scale).ptr = '\0';
+  /* An empty set is still emitted once, with an empty blob */
+  size_t i = 0;
+  do
+  {
+    size_t n = std::min((size_t) SAMPLESET_CHUNK, ss->len-i);
+    PackWords(buf,(const char *) ss->v+i*width,n,width);
+    if (ss->enc == SAMPLE_F64)
+      RedisModule_EmitAOF(aof,"random.sload","sb",key,buf,n*width);
+    else if (ss->enc == SAMPLE_F32)
+      RedisModule_EmitAOF(aof,"random.sload","sbcc",key,buf,n*width,
+                          "ENCODING",SampleEncodings[ss->enc]);
+    else
+      RedisModule_EmitAOF(aof,"random.sload","sbcccc",key,buf,n*width,
+                          "ENCODING",SampleEncodings[ss->enc],"SCALE",scale);
+    i += n;
+  } while (i < ss->len);
+}
+
+size_t SampleSetMemUsage(const void *value) {
+  const SampleSet *ss = (const SampleSet *) value;
+  return sizeof(SampleSet) + ss->cap*SampleWidth(ss->enc);
+}
+
+void SampleSetDigest(RedisModuleDigest *md, void *value) {
+  SampleSet *ss = (SampleSet *) value;
+  size_t width = SampleWidth(ss->enc);
+  char buf[sizeof(double)];
+  for (size_t i=0; i < ss->len; i++)
+  {
+    PackWords(buf,(const char *) ss->v+i*width,1,width);
+    RedisModule_DigestAddStringBuffer(md,(unsigned char *) buf,width);
+  }
+  RedisModule_DigestEndSequence(md);
+}
+
+/* Largest CELLS and COLUMNS accepted by RANDOM.HIST */
+#define HIST_MAX_CELLS (1<<20)
+
+/* Counts samples within [min,max] into slots equal cells, the samples
+ * being v[i]*unit */
+template <class T>
+void HistAdd(long long *hist, long long slots, double min, double max, const T *v, size_t n, double unit = 1) {
+  double range = max-min;
+  double scale = range > 0 ? slots/range : 0;
+  for (size_t i=0; i < n; i++)
+  {
+    double e = v[i]*unit;
+    if (!(e >= min && e <= max)) continue;
+    long long slot = (long long) ((e-min)*scale);
+    if (slot >= slots) slot = slots-1; /* max value goes to last slot */
+    hist[slot]++;
+  }
+}
+
+/* HistAdd over a sample set, reading its encoding as it is */
+void SampleSetHist(const SampleSet *ss, long long *hist, long long slots, double min, double max) {
+  switch (ss->enc)
+  {
+  case SAMPLE_F64:
+    HistAdd(hist,slots,min,max,(const double *) ss->v,ss->len);
+    break;
+  case SAMPLE_F32:
+    HistAdd(hist,slots,min,max,(const float *) ss->v,ss->len);
+    break;
+  case SAMPLE_I16:
+    HistAdd(hist,slots,min,max,(const int16_t *) ss->v,ss->len,ss->scale);
+    break;
+  case SAMPLE_I32:
+    HistAdd(hist,slots,min,max,(const int32_t *) ss->v,ss->len,ss->scale);
+    break;
+  }
+}
+
+template <class T>
+void MinMax(const T *v, size_t n, double unit, double *min, double *max) {
+  T lo = v[0], hi = v[0];
+  for (size_t i=1; i < n; i++)
+  {
+    if (v[i] < lo) lo = v[i];
+    if (v[i] > hi) hi = v[i];
+  }
+  *min = lo*unit;
+  *max = hi*unit;
+}
+
+/* Smallest and largest samples of a set that is not empty */
+void SampleSetRange(const SampleSet *ss, double *min, double *max) {
+  switch (ss->enc)
+  {
+  case SAMPLE_F64:
+    MinMax((const double *) ss->v,ss->len,1,min,max);
+    break;
+  case SAMPLE_F32:
+    MinMax((const float *) ss->v,ss->len,1,min,max);
+    break;
+  case SAMPLE_I16:
+    MinMax((const int16_t *) ss->v,ss->len,ss->scale,min,max);
+    break;
+  case SAMPLE_I32:
+    MinMax((const int32_t *) ss->v,ss->len,ss->scale,min,max);
+    break;
+  }
+}
+
+/* Quantile sketches
+ * A DDSketch: samples are counted in buckets of |x| whose bounds grow by
+ * gamma = (1+alpha)/(1-alpha), so every quantile comes back within a
+ * relative error alpha of the sample at that rank. Positive and negative
+ * samples have their own buckets, zeros a counter. Sketches with the same
+ * alpha merge by adding up their counts, so sketches made on each node of
+ * a cluster combine into the sketch of all the samples. */
+static RedisModuleType *SketchType;
+
+/* Relative accuracy used when none is given, and the accepted range */
+#define SKETCH_ALPHA 0.01
+#define SKETCH_MIN_ALPHA 0.0001
+#define SKETCH_MAX_ALPHA 0.5
+
+/* Buckets kept per sign. Past it the buckets of smallest magnitude are
+ * collapsed into one, so only quantiles near zero lose accuracy. */
+#define SKETCH_MAX_BINS 2048
+
+/* Version byte at the start of exported sketches */
+#define SKETCH_BLOB_VERSION 1
+
+struct SketchStore {
+  int offset;                  /* bucket index of bins[0] */
+  std::vector<uint64_t> bins;
+};
+
+struct Sketch {
+  double alpha;                /* 0 when there is no sketch */
+  double gamma, lgamma;        /* bucket growth and its log */
+  SketchStore pos, neg;
+  uint64_t zero;               /* samples equal to 0 */
+  uint64_t count;
+  double min, max;
+};
+
+void SketchInit(Sketch *sk, double alpha) {
+  sk->alpha = alpha;
+  sk->gamma = (1+alpha)/(1-alpha);
+  sk->lgamma = std::log(sk->gamma);
+  sk->pos.offset = sk->neg.offset = 0;
+  sk->pos.bins.clear();
+  sk->neg.bins.clear();
+  sk->zero = sk->count = 0;
+  sk->min = INFINITY;
+  sk->max = -INFINITY;
+}
+
+Sketch *SketchCreate(double alpha) {
+  Sketch *sk = new Sketch;
+  SketchInit(sk,alpha);
+  return sk;
+}
+
+void SketchFree(void *value) {
+  delete (Sketch *) value;
+}
+
+/* Widens a store to cover bucket i, collapsing the lowest buckets if it
+ * would go past SKETCH_MAX_BINS */
+void SketchStoreGrow(SketchStore *st, int i) {
+  int size = st->bins.size();
+  if (size == 0)
+  {
+    st->offset = i;
+    st->bins.assign(1,0);
+    return;
+  }
+  int lo = std::min(i,st->offset);
+  int hi = std::max(i,st->offset+size-1);
+  if (hi-lo >= SKETCH_MAX_BINS) lo = hi-SKETCH_MAX_BINS+1;
+  std::vector<uint64_t> bins(hi-lo+1,0);
+  for (int k=0; k < size; k++)
+    bins[std::max(st->offset+k,lo)-lo] += st->bins[k];
+  st->bins.swap(bins);
+  st->offset = lo;
+}
+
+inline void SketchStoreAdd(SketchStore *st, int i, uint64_t n) {
+  if (i < st->offset || i >= st->offset+(int) st->bins.size())
+  {
+    SketchStoreGrow(st,i);
+    if (i < st->offset) i = st->offset;
+  }
+  st->bins[i-st->offset] += n;
+}
+
+/* Counts samples into the sketch. Infinite samples are left out. */
+void SketchAdd(Sketch *sk, const double *v, size_t n) {
+  double scale = 1/sk->lgamma;
+  for (size_t i=0; i < n; i++)
+  {
+    double x = v[i];
+    if (!std::isfinite(x)) continue;
+    if (x > 0)
+      SketchStoreAdd(&sk->pos,(int) std::ceil(std::log(x)*scale),1);
+    else if (x < 0)
+      SketchStoreAdd(&sk->neg,(int) std::ceil(std::log(-x)*scale),1);
+    else
+      sk->zero++;
+    if (x < sk->min) sk->min = x;
+    if (x > sk->max) sk->max = x;
+    sk->count++;
+  }
+}
+
+/* Adds the counts of src, which must have the same alpha */
+void SketchMerge(Sketch *dst, const Sketch *src) {
+  for (size_t k=0; k < src->pos.bins.size(); k++)
+    if (src->pos.bins[k]) SketchStoreAdd(&dst->pos,src->pos.offset+(int) k,src->pos.bins[k]);
+  for (size_t k=0; k < src->neg.bins.size(); k++)
+    if (src->neg.bins[k]) SketchStoreAdd(&dst->neg,src->neg.offset+(int) k,src->neg.bins[k]);
+  dst->zero += src->zero;
+  dst->count += src->count;
+  if (src->min < dst->min) dst->min = src->min;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+/* Bucket i holds |x| in (gamma^(i-1),gamma^i], this is within alpha of all */
+inline double SketchBinValue(const Sketch *sk, int i) {
+  return 2*std::exp(i*sk->lgamma)/(sk->gamma+1);
+}
+
+/* The sample of rank q*(count-1), from the most negative to the most
+ * positive, within the bounds seen. Needs count > 0. */
+double SketchQuantile(const Sketch *sk, double q) {
+  double rank = q*(sk->count-1);
+  uint64_t seen = 0;
+  double x = sk->max;
+  int k, nneg = sk->neg.bins.size(), npos = sk->pos.bins.size();
+  for (k=nneg-1; k >= 0; k--)
+    if ((seen += sk->neg.bins[k]) > rank) break;
+  if (k >= 0)
+    x = -SketchBinValue(sk,sk->neg.offset+k);
+  else if ((seen += sk->zero) > rank)
+    x = 0;
+  else
+  {
+    for (k=0; k < npos; k++)
+      if ((seen += sk->pos.bins[k]) > rank) break;
+    if (k < npos) x = SketchBinValue(sk,sk->pos.offset+k);
+  }
+  return std::min(std::max(x,sk->min),sk->max);
+}
+
+void PutVarint(std::string &s, uint64_t v) {
+  while (v >= 0x80)
+  {
+    s.push_back((char) (v | 0x80));
+    v >>= 7;
+  }
+  s.push_back((char) v);
+}
+
+int GetVarint(const char **p, const char *end, uint64_t *v) {
+  *v = 0;
+  for (int shift=0; shift < 64 && *p < end; shift += 7)
+  {
+    uint8_t b = *(*p)++;
+    *v |= (uint64_t) (b & 0x7f) << shift;
+    if (!(b & 0x80)) return REDISMODULE_OK;
+  }
+  return REDISMODULE_ERR;
+}
+
+/* Exported sketches: a version byte, alpha, min and max as little endian
+ * doubles, then varints for the count, the zeros, and for the negative and
+ * then positive buckets their zigzag offset, length and counts. The same
+ * bytes come out on any node, whatever its byte order. */
+std::string SketchEncode(const Sketch *sk) {
+  double d[3] = {sk->alpha, sk->min, sk->max};
+  std::string s(1+sizeof(d),0);
+  s[0] = SKETCH_BLOB_VERSION;
+  PackSamples(&s[1],d,3);
+  PutVarint(s,sk->count);
+  PutVarint(s,sk->zero);
+  for (const SketchStore *st : {&sk->neg, &sk->pos})
+  {
+    PutVarint(s,((uint64_t) st->offset << 1) ^ (uint64_t) (int64_t) (st->offset >> 31));
+    PutVarint(s,st->bins.size());
+    for (uint64_t c : st->bins)
+      PutVarint(s,c);
+  }
+  return s;
+}
+
+/* Returns NULL if the blob is not a valid sketch */
+Sketch *SketchDecode(const char *p, size_t len) {
+  const char *end = p+len;
+  double d[3];
+  if (len < 1+sizeof(d) || *p != SKETCH_BLOB_VERSION) return NULL;
+  UnpackSamples(d,p+1,3);
+  p += 1+sizeof(d);
+  if (!(d[0] >= SKETCH_MIN_ALPHA && d[0] <= SKETCH_MAX_ALPHA)) return NULL;
+
+  Sketch *sk = SketchCreate(d[0]);
+  uint64_t count, zero, total;
+  int ok = GetVarint(&p,end,&count) == REDISMODULE_OK &&
+           GetVarint(&p,end,&zero) == REDISMODULE_OK;
+  total = zero;
+  for (SketchStore *st : {&sk->neg, &sk->pos})
+  {
+    uint64_t zz, size;
+    if (!ok || GetVarint(&p,end,&zz) != REDISMODULE_OK ||
+        GetVarint(&p,end,&size) != REDISMODULE_OK ||
+        zz >= (1ULL << 30) || size > SKETCH_MAX_BINS)
+    {
+      ok = 0;
+      break;
+    }
+    st->offset = (int) ((zz >> 1) ^ (0-(zz & 1)));
+    st->bins.resize(size);
+    for (uint64_t &c : st->bins)
+    {
+      if (GetVarint(&p,end,&c) != REDISMODULE_OK)
+      {
+        ok = 0;
+        break;
+      }
+      total += c;
+    }
+  }
+  /* Bounds are checked in the negated form so NaN fails too */
+  if (!ok || p != end || total != count ||
+      (count > 0 && !(d[1] <= d[2] && std::isfinite(d[1]) && std::isfinite(d[2]))))
+  {
+    SketchFree(sk);
+    return NULL;
+  }
+  sk->zero = zero;
+  sk->count = count;
+  if (count > 0)
+  {
+    sk->min = d[1];
+    sk->max = d[2];
+  }
+  return sk;
+}
+
+void *SketchRdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver != 0) return NULL;
+  size_t len;
+  char *blob = RedisModule_LoadStringBuffer(rdb,&len);
+  Sketch *sk = SketchDecode(blob,len);
+  RedisModule_Free(blob);
+  if (sk == NULL)
+    RedisModule_LogIOError(rdb,"warning","Bad quantile sketch");
+  return sk;
+}
+
+void SketchRdbSave(RedisModuleIO *rdb, void *value) {
+  std::string blob = SketchEncode((Sketch *) value);
+  RedisModule_SaveStringBuffer(rdb,blob.data(),blob.size());
+}
+
+/* Rewritten as a RANDOM.QMERGE of the exported sketch into the empty key */
+void SketchAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+  std::string blob = SketchEncode((Sketch *) value);
+  RedisModule_EmitAOF(aof,"random.qmerge","sb",key,blob.data(),blob.size());
+}
+
+size_t SketchMemUsage(const void *value) {
+  const Sketch *sk = (const Sketch *) value;
+  return sizeof(Sketch) + (sk->pos.bins.capacity()+sk->neg.bins.capacity())*sizeof(uint64_t);
+}
+
+void SketchDigest(RedisModuleDigest *md, void *value) {
+  std::string blob = SketchEncode((Sketch *) value);
+  RedisModule_DigestAddStringBuffer(md,(unsigned char *) blob.data(),blob.size());
+  RedisModule_DigestEndSequence(md);
+}
+
+/* Command stats
+ * Every command is registered wrapped in Timed<f>, which counts its calls
+ * and the time they take on the main thread, read from the time stamp
+ * counter, and points curStats at its counters while it runs so the code
+ * below adds the samples made, the bytes written to keys and the samples
+ * scanned to them. Counters are only changed on the main thread, so
+ * plain integers do. */
+struct CommandStats {
+  std::string name;          /* empty until first called */
+  long long calls;
+  long long samples;         /* samples generated */
+  long long async;           /* calls handed to a worker */
+  long long bytes;           /* bytes of samples written to keys */
+  long long scanned;         /* samples read by scans of keys */
+  uint64_t ticks, maxticks;  /* main thread time */
+  uint64_t scanticks;
+  long long latency[64];     /* calls by floor(log2(ticks)) */
+};
+
+std::vector<CommandStats *> commandStats;
+CommandStats noStats;        /* for work outside of commands */
+CommandStats *curStats = &noStats;
+
+/* Time stamp when the module loaded, in ticks and in ns, to turn ticks
+ * into time when replying */
+uint64_t statsTicks0;
+std::chrono::steady_clock::time_point statsTime0;
+
+inline uint64_t StatsClock() {
+#ifdef HAVE_X86_SIMD
+  return __builtin_ia32_rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+/* Ticks per microsecond, measured since the module loaded */
+double StatsTicksPerUsec() {
+  double us = std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-statsTime0).count();
+  double rate = us > 0 ? (StatsClock()-statsTicks0)/us : 1;
+  return rate > 0 ? rate : 1;
+}
+
+template <RedisModuleCmdFunc f>
+int Timed(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  static CommandStats stats;
+  if (RedisModule_IsKeysPositionRequest(ctx)) return f(ctx,argv,argc);
+  if (stats.name.empty())
+  {
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(argv[0],&len);
+    for (size_t i=0; i < len; i++) stats.name += tolower(p[i]);
+    commandStats.push_back(&stats);
+  }
+  CommandStats *prev = curStats;
+  curStats = &stats;
+  uint64_t t0 = StatsClock();
+  int ret;
+  /* Exceptions must not unwind into Redis */
+  try
+  {
+    ret = f(ctx,argv,argc);
+  }
+  catch (const std::exception &)
+  {
+    ret = RedisModule_ReplyWithError(ctx,"ERR out of memory");
+  }
+  uint64_t t = StatsClock()-t0;
+  curStats = prev;
+  stats.calls++;
+  stats.ticks += t;
+  if (t > stats.maxticks) stats.maxticks = t;
+  stats.latency[63-__builtin_clzll(t|1)]++;
+  return ret;
+}
+
+/* Keyword options accepted after the positional arguments of a command */
+#define OPT_COUNT  (1<<0)   /* COUNT n: reply with n samples */
+#define OPT_PACKED (1<<1)   /* PACKED: store samples as a sample set */
+#define OPT_ENGINE (1<<2)   /* ENGINE name: engine other than the default */
+#define OPT_MIN    (1<<3)   /* MIN x: lower bound */
+#define OPT_MAX    (1<<4)   /* MAX x: upper bound */
+#define OPT_LIVEHIST (1<<5) /* LIVEHIST cells min max: keep a live histogram */
+#define OPT_SKETCH (1<<6)   /* SKETCH alpha: keep a live quantile sketch */
+#define OPT_ALPHA  (1<<7)   /* ALPHA alpha: accuracy of a new sketch */
+#define OPT_SEED   (1<<8)   /* SEED s: seed of a private engine */
+#define OPT_TAIL   (1<<9)   /* TAIL: push list elements at the tail */
+#define OPT_ABOVE  (1<<10)  /* ABOVE x: count samples above x */
+#define OPT_SCRAMBLE (1<<11) /* SCRAMBLE: randomize a low discrepancy sequence */
+#define OPT_NORM   (1<<12)  /* NORM mean sd: map points to normals */
+#define OPT_EXP    (1<<13)  /* EXP lambda: map points to exponentials */
+#define OPT_ENCODING (1<<14) /* ENCODING e [SCALE s]: how samples are stored */
+
+struct Options {
+  long long count;   /* -1 when not given */
+  int packed;
+  Engine *engine;
+  int hasmin, hasmax;
+  double min, max;
+  long long livecells;   /* 0 when not given */
+  double livemin, livemax;
+  double alpha;          /* 0 when not given */
+  int hasseed;
+  uint64_t seed;
+  int tail;
+  int hasabove;
+  double above;
+  int scramble;
+  int inverse;           /* OPT_NORM, OPT_EXP or 0 */
+  double invp[2];
+  int encoding;          /* SAMPLE_*, SAMPLE_F64 when not given */
+  double scale;          /* 0 when not given */
+};
+
+struct OptionSpec {
+  const char *name;
+  int flag;
+  int nargs;
+};
+
+static const OptionSpec OptionSpecs[] = {
+  {"COUNT", OPT_COUNT, 1},
+  {"PACKED", OPT_PACKED, 0},
+  {"ENGINE", OPT_ENGINE, 1},
+  {"MIN", OPT_MIN, 1},
+  {"MAX", OPT_MAX, 1},
+  {"LIVEHIST", OPT_LIVEHIST, 3},
+  {"SKETCH", OPT_SKETCH, 1},
+  {"ALPHA", OPT_ALPHA, 1},
+  {"SEED", OPT_SEED, 1},
+  {"TAIL", OPT_TAIL, 0},
+  {"ABOVE", OPT_ABOVE, 1},
+  {"SCRAMBLE", OPT_SCRAMBLE, 0},
+  {"NORM", OPT_NORM, 2},
+  {"EXP", OPT_EXP, 1},
+  {"ENCODING", OPT_ENCODING, 1},
+  {"SCALE", OPT_ENCODING, 1},
+};
+
+/* Parses the trailing options allowed by mask and cuts argc down to the
+ * positional arguments before them, so the usual arity checks apply.
+ * Arguments before position first are never taken as options. On a bad
+ * option replies with an error and returns REDISMODULE_ERR. */
+int ParseOptions(RedisModuleCtx *ctx, RedisModuleString **argv, int *argc, int first, int mask, Options *opt) {
+  opt->count = -1;
+  opt->packed = 0;
+  opt->engine = defaultEngine;
+  opt->hasmin = opt->hasmax = 0;
+  opt->livecells = 0;
+  opt->alpha = 0;
+  opt->hasseed = 0;
+  opt->tail = 0;
+  opt->hasabove = 0;
+  opt->scramble = 0;
+  opt->inverse = 0;
+  opt->encoding = SAMPLE_F64;
+  opt->scale = 0;
+  int hasencoding = 0;
+
+  /* Options start at the first allowed keyword */
+  int i, end = *argc;
+  for (i=first; i < end; i++)
+  {
+    const char *s = RedisModule_StringPtrLen(argv[i],NULL);
+    size_t j;
+    for (j=0; j < sizeof(OptionSpecs)/sizeof(OptionSpecs[0]); j++)
+      if ((OptionSpecs[j].flag & mask) && !strcasecmp(s,OptionSpecs[j].name)) break;
+    if (j < sizeof(OptionSpecs)/sizeof(OptionSpecs[0])) break;
+  }
+  *argc = i;
+
+  while (i < end)
+  {
+    const char *s = RedisModule_StringPtrLen(argv[i],NULL);
+    const OptionSpec *spec = NULL;
+    for (size_t j=0; j < sizeof(OptionSpecs)/sizeof(OptionSpecs[0]); j++)
+      if ((OptionSpecs[j].flag & mask) && !strcasecmp(s,OptionSpecs[j].name))
+        spec = &OptionSpecs[j];
+    if (spec == NULL || i+spec->nargs >= end)
+    {
+      RedisModule_ReplyWithError(ctx,"ERR syntax error");
+      return REDISMODULE_ERR;
+    }
+    switch (spec->flag)
+    {
+      case OPT_COUNT:
+        if ((RedisModule_StringToLongLong(argv[i+1],&opt->count) != REDISMODULE_OK) ||
+            (opt->count < 0))
+        {
+          RedisModule_ReplyWithError(ctx,"ERR invalid count");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case OPT_PACKED:
+        opt->packed = 1;
+        break;
+      case OPT_TAIL:
+        opt->tail = 1;
+        break;
+      case OPT_SCRAMBLE:
+        opt->scramble = 1;
+        break;
+      case OPT_NORM:
+        if ((RedisModule_StringToDouble(argv[i+1],&opt->invp[0]) != REDISMODULE_OK) ||
+            (RedisModule_StringToDouble(argv[i+2],&opt->invp[1]) != REDISMODULE_OK) ||
+            !(opt->invp[1] >= 0))
+        {
+          RedisModule_ReplyWithError(ctx,"ERR invalid normal parameters");
+          return REDISMODULE_ERR;
+        }
+        opt->inverse = OPT_NORM;
+        break;
+      case OPT_EXP:
+        if ((RedisModule_StringToDouble(argv[i+1],&opt->invp[0]) != REDISMODULE_OK) ||
+            !(opt->invp[0] > 0))
+        {
+          RedisModule_ReplyWithError(ctx,"ERR invalid lambda");
+          return REDISMODULE_ERR;
+        }
+        opt->inverse = OPT_EXP;
+        break;
+      case OPT_MIN:
+      case OPT_MAX:
+      case OPT_ABOVE:
+      {
+        double d;
+        if (RedisModule_StringToDouble(argv[i+1],&d) != REDISMODULE_OK)
+        {
+          RedisModule_ReplyWithError(ctx,"ERR invalid bound");
+          return REDISMODULE_ERR;
+        }
+        if (spec->flag == OPT_MIN) { opt->min = d; opt->hasmin = 1; }
+        else if (spec->flag == OPT_MAX) { opt->max = d; opt->hasmax = 1; }
+        else { opt->above = d; opt->hasabove = 1; }
+        break;
+      }
+      case OPT_LIVEHIST:
+        if ((RedisModule_StringToLongLong(argv[i+1],&opt->livecells) != REDISMODULE_OK) ||
+            (opt->livecells < 1) || (opt->livecells > HIST_MAX_CELLS) ||
+            (RedisModule_StringToDouble(argv[i+2],&opt->livemin) != REDISMODULE_OK) ||
+            (RedisModule_StringToDouble(argv[i+3],&opt->livemax) != REDISMODULE_OK) ||
+            !(opt->livemin < opt->livemax))
+        {
+          RedisModule_ReplyWithError(ctx,"ERR invalid live histogram");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case OPT_SKETCH:
+      case OPT_ALPHA:
+        if ((RedisModule_StringToDouble(argv[i+1],&opt->alpha) != REDISMODULE_OK) ||
+            !(opt->alpha >= SKETCH_MIN_ALPHA && opt->alpha <= SKETCH_MAX_ALPHA))
+        {
+          RedisModule_ReplyWithError(ctx,"ERR invalid sketch accuracy");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case OPT_SEED:
+      {
+        long long ll;
+        if (RedisModule_StringToLongLong(argv[i+1],&ll) != REDISMODULE_OK)
+        {
+          RedisModule_ReplyWithError(ctx,"ERR invalid seed");
+          return REDISMODULE_ERR;
+        }
+        opt->seed = (uint64_t) ll;
+        opt->hasseed = 1;
+        break;
+      }
+      case OPT_ENGINE:
+        opt->engine = EngineByName(RedisModule_StringPtrLen(argv[i+1],NULL));
+        if (opt->engine == NULL)
+        {
+          RedisModule_ReplyWithError(ctx,"ERR unknown engine");
+          return REDISMODULE_ERR;
+        }
+        break;
+      case OPT_ENCODING:
+        if (!strcasecmp(s,"SCALE"))
+        {
+          if ((RedisModule_StringToDouble(argv[i+1],&opt->scale) != REDISMODULE_OK) ||
+              !(opt->scale > 0) || !std::isfinite(opt->scale))
+          {
+            RedisModule_ReplyWithError(ctx,"ERR invalid scale");
+            return REDISMODULE_ERR;
+          }
+          break;
+        }
+        {
+          const char *e = RedisModule_StringPtrLen(argv[i+1],NULL);
+          int j;
+          for (j=SAMPLE_F64; j <= SAMPLE_I32; j++)
+            if (!strcasecmp(e,SampleEncodings[j])) break;
+          if (j > SAMPLE_I32 && strcasecmp(e,"text"))
+          {
+            RedisModule_ReplyWithError(ctx,"ERR unknown encoding");
+            return REDISMODULE_ERR;
+          }
+          opt->encoding = j > SAMPLE_I32 ? SAMPLE_TEXT : j;
+          hasencoding = 1;
+        }
+        break;
+    }
+    i += 1+spec->nargs;
+  }
+
+  /* Binary encodings are kept packed, integers need their scale */
+  if (hasencoding)
+  {
+    if (opt->encoding == SAMPLE_TEXT && opt->packed)
+    {
+      RedisModule_ReplyWithError(ctx,"ERR PACKED needs a binary encoding");
+      return REDISMODULE_ERR;
+    }
+    opt->packed = opt->encoding != SAMPLE_TEXT;
+  }
+  if ((opt->encoding == SAMPLE_I16 || opt->encoding == SAMPLE_I32) != (opt->scale > 0))
+  {
+    RedisModule_ReplyWithError(ctx,opt->scale > 0 ? "ERR SCALE is for int16 and int32" :
+                               "ERR int16 and int32 need a SCALE");
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+/* Samples generated per batch by the bulk commands. Like ASYNC_CHUNK it is
+ * a multiple of ENGINE_BUFFER, which the samplers take words by, so a
+ * seeded engine gives the same samples whatever the batches. */
+#define SAMPLE_BATCH 1024
+
+/* Live histograms and sketches
+ * A key filled by the l* commands with LIVEHIST carries a histogram with
+ * fixed cells, and with SKETCH a quantile sketch, kept up to date as
+ * samples are added, so RANDOM.HIST and RANDOM.QUANTILE do not need to
+ * scan the key. The l* commands add their samples directly.
+ * Pushes by other commands are picked up from keyspace notifications by
+ * reading the new elements. Removals cannot be followed that way, as the
+ * removed values are gone, so they mark the stats dirty and the next
+ * reader rescans the key once. Live stats live in module memory only,
+ * and are not saved with the keys. */
+struct LiveStats {
+  long long cells;           /* 0 when there is no histogram */
+  double min, max;           /* bounds of the cells */
+  std::vector<long long> bins;
+  long long under, over;     /* samples below min, above max */
+  long long count;           /* samples counted, under and over included */
+  double lo, hi;             /* smallest and largest sample counted */
+  Sketch sketch;
+  size_t len;                /* key length the counts are for */
+  int dirty;                 /* counts are stale, rescan before use */
+};
+
+/* By database and key name */
+std::unordered_map<std::string,LiveStats> liveStats;
+
+std::string LiveStatsId(int db, RedisModuleString *keyname) {
+  size_t len;
+  const char *p = RedisModule_StringPtrLen(keyname,&len);
+  std::string id = std::to_string(db);
+  id.push_back(':');
+  id.append(p,len);
+  return id;
+}
+
+LiveStats *LiveStatsFind(RedisModuleCtx *ctx, RedisModuleString *keyname) {
+  if (liveStats.empty()) return NULL;
+  auto it = liveStats.find(LiveStatsId(RedisModule_GetSelectedDb(ctx),keyname));
+  return it == liveStats.end() ? NULL : &it->second;
+}
+
+void LiveStatsReset(LiveStats *ls) {
+  std::fill(ls->bins.begin(),ls->bins.end(),0);
+  ls->under = ls->over = ls->count = 0;
+  ls->lo = INFINITY;
+  ls->hi = -INFINITY;
+  if (ls->sketch.alpha) SketchInit(&ls->sketch,ls->sketch.alpha);
+  ls->len = 0;
+  ls->dirty = 0;
+}
+
+/* Adds or replaces the live histogram and sketch of a key asked for by the
+ * LIVEHIST and SKETCH options, keeping the other one. Counts start over,
+ * dirty if the key already holds samples. */
+LiveStats *LiveStatsCreate(RedisModuleCtx *ctx, RedisModuleString *keyname, Options *opt, size_t len) {
+  auto it = liveStats.try_emplace(LiveStatsId(RedisModule_GetSelectedDb(ctx),keyname));
+  LiveStats &ls = it.first->second;
+  if (it.second)
+  {
+    ls.cells = 0;
+    ls.sketch.alpha = 0;
+  }
+  if (opt->livecells)
+  {
+    ls.cells = opt->livecells;
+    ls.min = opt->livemin;
+    ls.max = opt->livemax;
+    ls.bins.assign(ls.cells,0);
+  }
+  if (opt->alpha) ls.sketch.alpha = opt->alpha;
+  LiveStatsReset(&ls);
+  ls.dirty = len > 0;
+  return &ls;
+}
+
+void LiveStatsAdd(LiveStats *ls, const double *v, size_t n) {
+  if (ls->sketch.alpha) SketchAdd(&ls->sketch,v,n);
+  if (ls->cells == 0) return;
+  HistAdd(ls->bins.data(),ls->cells,ls->min,ls->max,v,n);
+  for (size_t i=0; i < n; i++)
+  {
+    if (v[i] < ls->min) ls->under++;
+    else if (v[i] > ls->max) ls->over++;
+    if (v[i] < ls->lo) ls->lo = v[i];
+    if (v[i] > ls->hi) ls->hi = v[i];
+  }
+  ls->count += n;
+}
+
+/* Worker pool
+ * Commands with a large COUNT that only reply run on module threads while
+ * their client is blocked, so the event loop keeps serving other clients.
+ * Each worker has engines of its own, seeded apart from the shared ones.
+ * Replies are built in a thread safe context, which needs no lock.
+ * Commands that write keys run inline, as they are replicated when called.
+ * Scans and fills go over samples ASYNC_CHUNK at a time. */
+#define ASYNC_CHUNK 4096
+
+struct AsyncJob {
+  RedisModuleBlockedClient *bc;
+  size_t engine;        /* index in Engines */
+  std::function<void(RedisModuleCtx *, Engine &)> run;
+};
+
+/* Workers started at load with THREADS, and the COUNT from which commands
+ * use them, set with ASYNC */
+std::vector<EngineSet *> workers;
+long long asyncCount = 100000;
+
+/* Never freed: workers wait on it until the process exits, and destroying
+ * a condition variable with waiters blocks */
+struct AsyncQueue {
+  std::deque<AsyncJob *> jobs;
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+AsyncQueue *asyncQueue;
+
+void WorkerMain(EngineSet *w) {
+  AsyncQueue *q = asyncQueue;
+  for (;;)
+  {
+    AsyncJob *job;
+    {
+      std::unique_lock<std::mutex> lock(q->mutex);
+      q->cond.wait(lock,[q] { return !q->jobs.empty(); });
+      job = q->jobs.front();
+      q->jobs.pop_front();
+    }
+    RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(job->bc);
+    try
+    {
+      job->run(ctx,*w->engines[job->engine]);
+    }
+    catch (const std::exception &)
+    {
+      RedisModule_ReplyWithError(ctx,"ERR out of memory");
+    }
+    RedisModule_FreeThreadSafeContext(ctx);
+    RedisModule_UnblockClient(job->bc,NULL);
+    delete job;
+  }
+}
+
+void StartWorkers(long long n) {
+  if (n > 0) asyncQueue = new AsyncQueue;
+  for (long long i=0; i < n; i++)
+  {
+    EngineSet *w = new EngineSet;
+    for (Engine *e : w->engines)
+      e->reseed(((uint64_t) rd() << 32) | rd());
+    workers.push_back(w);
+    std::thread(WorkerMain,w).detach();
+  }
+}
+
+/* Context flags of later servers, for clients that cannot block there.
+ * Redis 5 sets neither, and the commands run from the AOF in it are the
+ * ones writing keys, which never come here. */
+#ifndef REDISMODULE_CTX_FLAGS_LOADING
+#define REDISMODULE_CTX_FLAGS_LOADING (1<<13)
+#endif
+#ifndef REDISMODULE_CTX_FLAGS_DENY_BLOCKING
+#define REDISMODULE_CTX_FLAGS_DENY_BLOCKING (1<<21)
+#endif
+
+/* Blocks the client and hands f(ctx,eng) to a worker, which replies in
+ * ctx with an engine of the same kind as eng. Returns 0 if the command is
+ * to run inline instead: when there are no workers, count is below
+ * asyncCount, or the client cannot block, as in MULTI, Lua scripts, the
+ * replication link and AOF loading. Commands that write keys must not
+ * use it, as they are replicated and logged to the AOF when called. */
+template <class F>
+int RunAsync(RedisModuleCtx *ctx, long long count, Engine *eng, F f) {
+  if (workers.empty() || count < asyncCount ||
+      (RedisModule_GetContextFlags(ctx) & (REDISMODULE_CTX_FLAGS_MULTI |
+        REDISMODULE_CTX_FLAGS_LUA | REDISMODULE_CTX_FLAGS_REPLICATED |
+        REDISMODULE_CTX_FLAGS_LOADING | REDISMODULE_CTX_FLAGS_DENY_BLOCKING)))
+    return 0;
+  curStats->async++;
+  AsyncJob *job = new AsyncJob;
+  job->bc = RedisModule_BlockClient(ctx,NULL,NULL,NULL,0);
+  job->engine = EngineIndex(eng);
+  job->run = f;
+  {
+    std::lock_guard<std::mutex> lock(asyncQueue->mutex);
+    asyncQueue->jobs.push_back(job);
+  }
+  asyncQueue->cond.notify_one();
+  return 1;
+}
+
+/* Sample rings
+ * With RINGS n at load, a module thread keeps rings of n samples made
+ * ahead for the single samples of RANDOM.NORM, RANDOM.EXP, RANDOM.UNIF and
+ * RANDOM.DUNIF on the default engine: standard normals, standard
+ * exponentials and words, which each call turns into a sample with its
+ * own parameters, so three rings serve all of them. Each ring has the main
+ * thread as its only consumer and the ring thread as its only producer,
+ * sharing two atomic positions and no lock. A call finding its ring empty
+ * draws inline as without rings. The ring thread is woken once a ring is
+ * below half full, and the time until it has filled it is the refill lag. */
+enum {RING_NORM, RING_EXP, RING_WORD, RING_KINDS};
+
+static const char *RingNames[RING_KINDS] = {"norm", "exp", "word"};
+
+/* Largest RINGS, which is rounded up to a power of two */
+#define RING_MAX_SIZE (1<<24)
+
+union RingSlot {
+  double d;
+  uint64_t w;
+};
+
+struct Ring {
+  std::vector<RingSlot> v;
+  alignas(64) std::atomic<size_t> head;   /* next to pop, by the main thread */
+  long long hits, misses;
+  alignas(64) std::atomic<size_t> tail;   /* next to fill, by the ring thread */
+  std::atomic<uint64_t> wanted;           /* when woken for it, 0 if not */
+  std::atomic<long long> refills;
+  std::atomic<uint64_t> lagticks, maxlagticks;
+};
+
+Ring rings[RING_KINDS];
+size_t ringSize;   /* 0 without rings */
+
+/* Never freed, like the AsyncQueue */
+struct RingWaker {
+  std::mutex mutex;
+  std::condition_variable cond;
+  int wake;
+};
+
+RingWaker *ringWaker;
+
+inline void RingWake(Ring *r) {
+  uint64_t none = 0;
+  if (r->wanted.load(std::memory_order_relaxed) ||
+      !r->wanted.compare_exchange_strong(none,StatsClock()))
+    return;
+  {
+    std::lock_guard<std::mutex> lock(ringWaker->mutex);
+    ringWaker->wake = 1;
+  }
+  ringWaker->cond.notify_one();
+}
+
+/* Pops a sample of a kind for a single sample drawn from eng. Returns 0 if
+ * there is none, and the caller draws it inline. */
+inline int RingPop(int kind, Engine *eng, RingSlot *s) {
+  if (ringSize == 0 || eng != defaultEngine) return 0;
+  Ring *r = &rings[kind];
+  size_t h = r->head.load(std::memory_order_relaxed);
+  size_t t = r->tail.load(std::memory_order_acquire);
+  if (h == t)
+  {
+    r->misses++;
+    RingWake(r);
+    return 0;
+  }
+  *s = r->v[h & (ringSize-1)];
+  r->head.store(h+1,std::memory_order_release);
+  r->hits++;
+  if (t-h-1 < ringSize/2) RingWake(r);
+  return 1;
+}
+
+/* Fills the free slots of a ring, a batch at a time so the main thread
+ * can take the first ones while the rest are made */
+void RingFill(Ring *r, int kind, Engine &eng) {
+  double d[SAMPLE_BATCH];
+  uint64_t w[SAMPLE_BATCH];
+  size_t t = r->tail.load(std::memory_order_relaxed);
+  size_t space = ringSize - (t - r->head.load(std::memory_order_acquire));
+  while (space > 0)
+  {
+    size_t n = space < SAMPLE_BATCH ? space : SAMPLE_BATCH;
+    if (kind == RING_NORM) NormalFill(eng,d,n,0.0,1.0);
+    else if (kind == RING_EXP) ExpFill(eng,d,n,1.0);
+    else eng.words(w,n);
+    for (size_t i=0; i < n; i++)
+    {
+      RingSlot &slot = r->v[(t+i) & (ringSize-1)];
+      if (kind == RING_WORD) slot.w = w[i];
+      else slot.d = d[i];
+    }
+    t += n;
+    r->tail.store(t,std::memory_order_release);
+    space -= n;
+  }
+  uint64_t since = r->wanted.load();
+  if (since)
+  {
+    uint64_t lag = StatsClock()-since;
+    r->refills++;
+    r->lagticks += lag;
+    if (lag > r->maxlagticks) r->maxlagticks = lag;
+    r->wanted = 0;
+  }
+}
+
+/* Tops up the rings when woken, and every 100ms in case a ring was missed */
+void RingMain(EngineSet *es, size_t engine) {
+  RingWaker *q = ringWaker;
+  for (;;)
+  {
+    for (int k=0; k < RING_KINDS; k++)
+      RingFill(&rings[k],k,*es->engines[engine]);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    q->cond.wait_for(lock,std::chrono::milliseconds(100),[q] { return q->wake; });
+    q->wake = 0;
+  }
+}
+
+void StartRings(long long n) {
+  if (n <= 0) return;
+  ringSize = 1;
+  while (ringSize < (size_t) n) ringSize <<= 1;
+  for (Ring &r : rings) r.v.resize(ringSize);
+  ringWaker = new RingWaker;
+  ringWaker->wake = 0;
+  EngineSet *es = new EngineSet;
+  for (Engine *e : es->engines)
+    e->reseed(((uint64_t) rd() << 32) | rd());
+  std::thread(RingMain,es,EngineIndex(defaultEngine)).detach();
+}
+
+/* RANDOM.RINGS [RESET]
+ * For each ring: its size, samples in it now, pops served and missed,
+ * hit rate, refills and their average and largest lag in microseconds */
+int RandomRings_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc > 2) return RedisModule_WrongArity(ctx);
+  if (argc == 2)
+  {
+    if (strcasecmp(RedisModule_StringPtrLen(argv[1],NULL),"RESET"))
+      return RedisModule_ReplyWithError(ctx,"ERR syntax error");
+    for (Ring &r : rings)
+    {
+      r.hits = r.misses = 0;
+      r.refills = 0;
+      r.lagticks = r.maxlagticks = 0;
+    }
+    return RedisModule_ReplyWithSimpleString(ctx,"OK");
+  }
+  if (ringSize == 0) return RedisModule_ReplyWithArray(ctx,0);
+
+  double rate = StatsTicksPerUsec();
+  RedisModule_ReplyWithArray(ctx,RING_KINDS);
+  for (int k=0; k < RING_KINDS; k++)
+  {
+    Ring &r = rings[k];
+    long long refills = r.refills;
+    long long pops = r.hits+r.misses;
+    RedisModule_ReplyWithArray(ctx,17);
+    RedisModule_ReplyWithSimpleString(ctx,RingNames[k]);
+    RedisModule_ReplyWithSimpleString(ctx,"size");
+    RedisModule_ReplyWithLongLong(ctx,ringSize);
+    RedisModule_ReplyWithSimpleString(ctx,"fill");
+    RedisModule_ReplyWithLongLong(ctx,r.tail.load()-r.head.load());
+    RedisModule_ReplyWithSimpleString(ctx,"hits");
+    RedisModule_ReplyWithLongLong(ctx,r.hits);
+    RedisModule_ReplyWithSimpleString(ctx,"misses");
+    RedisModule_ReplyWithLongLong(ctx,r.misses);
+    RedisModule_ReplyWithSimpleString(ctx,"hit_rate");
+    RedisModule_ReplyWithDouble(ctx,pops ? (double) r.hits/pops : 0);
+    RedisModule_ReplyWithSimpleString(ctx,"refills");
+    RedisModule_ReplyWithLongLong(ctx,refills);
+    RedisModule_ReplyWithSimpleString(ctx,"lag_usec");
+    RedisModule_ReplyWithDouble(ctx,refills ? r.lagticks/rate/refills : 0);
+    RedisModule_ReplyWithSimpleString(ctx,"max_lag_usec");
+    RedisModule_ReplyWithDouble(ctx,r.maxlagticks/rate);
+  }
+  return REDISMODULE_OK;
+}
+
+/* Destination of the l* commands: a Redis list, or a packed sample set */
+struct SampleSink {
+  RedisModuleCtx *ctx;
+  RedisModuleKey *key;
+  SampleSet *ss;
+  int packed;   /* create a sample set if the key is empty */
+  int enc;      /* and its encoding */
+  double scale;
+  int where;    /* list end pushed to */
+  LiveStats *live;
+  CommandStats *stats;
+};
+
+/* Opens KEY for the l* commands, as asked by the PACKED and TAIL options.
+ * It must be empty, a list or a sample set. */
+int SampleSinkOpen(RedisModuleCtx *ctx, RedisModuleString *keyname, const Options *opt, SampleSink *sink) {
+  sink->ctx = ctx;
+  sink->key = (RedisModuleKey *) RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ | REDISMODULE_WRITE);
+  sink->ss = NULL;
+  sink->packed = opt->packed;
+  sink->enc = opt->encoding == SAMPLE_TEXT ? SAMPLE_F64 : opt->encoding;
+  sink->scale = opt->scale;
+  sink->where = opt->tail ? REDISMODULE_LIST_TAIL : REDISMODULE_LIST_HEAD;
+  sink->live = LiveStatsFind(ctx,keyname);
+  sink->stats = curStats;
+  int type = RedisModule_KeyType(sink->key);
+  if (type == REDISMODULE_KEYTYPE_MODULE &&
+      RedisModule_ModuleTypeGetType(sink->key) == SampleSetType)
+    sink->ss = (SampleSet *) RedisModule_ModuleTypeGetValue(sink->key);
+  else if (type != REDISMODULE_KEYTYPE_LIST && type != REDISMODULE_KEYTYPE_EMPTY)
+  {
+    RedisModule_CloseKey(sink->key);
+    return REDISMODULE_ERR;
+  }
+  /* Changes the stats missed, such as a FLUSHALL, would be hidden once
+   * the commit sets their length to the new one */
+  size_t len = sink->ss ? sink->ss->len : RedisModule_ValueLength(sink->key);
+  if (sink->live && sink->live->len != len) sink->live->dirty = 1;
+  return REDISMODULE_OK;
+}
+
+/* Called once the count is known, so a sample set grows only once */
+void SampleSinkReserve(SampleSink *sink, long long count) {
+  if (count == 0) return;
+  if (!sink->ss && sink->packed &&
+      RedisModule_KeyType(sink->key) == REDISMODULE_KEYTYPE_EMPTY)
+  {
+    sink->ss = SampleSetCreate(sink->enc,sink->scale);
+    RedisModule_ModuleTypeSetValue(sink->key,SampleSetType,sink->ss);
+  }
+  if (sink->ss) SampleSetReserve(sink->ss,sink->ss->len+count);
+}
+
+/* Longest text FormatSamples makes for a double, which is 24 chars */
+#define SAMPLE_TEXT_MAX 32
+
+/* Largest integer a double holds exactly, bound of stored integers */
+#define DIST_MAX_INT 9007199254740992.0
+
+/* Formats samples back to back in text, with the shortest digits that
+ * read back as the same double, and the end of each in ends. Integers
+ * below 2^53 are written in full, as "100000000" rather than "1e+08".
+ * text must have room for n*SAMPLE_TEXT_MAX chars. */
+void FormatSamples(const double *v, size_t n, char *text, uint32_t *ends) {
+  char *p = text;
+  for (size_t i=0; i < n; i++)
+  {
+    if (v[i] != 0 && std::fabs(v[i]) < DIST_MAX_INT && v[i] == std::trunc(v[i]))
+      p = std::to_chars(p,p+SAMPLE_TEXT_MAX,(long long) v[i]).ptr;
+    else
+      p = std::to_chars(p,p+SAMPLE_TEXT_MAX,v[i]).ptr;
+    ends[i] = p-text;
+  }
+}
+
+/* Pushes n samples formatted by FormatSamples to the list. Each element
+ * takes one string allocation, as ListPush copies it into the list. */
+void SampleSinkPushText(SampleSink *sink, const char *text, const uint32_t *ends, size_t n) {
+  uint32_t start = 0;
+  for (size_t i=0; i < n; i++)
+  {
+    RedisModuleString *ele = RedisModule_CreateString(sink->ctx,text+start,ends[i]-start);
+    RedisModule_ListPush(sink->key,sink->where,ele);
+    RedisModule_FreeString(sink->ctx,ele);
+    start = ends[i];
+  }
+  sink->stats->bytes += start;
+}
+
+/* Counts samples about to be added into the live stats, unless dirty */
+inline void SampleSinkLiveAdd(SampleSink *sink, const double *v, size_t n) {
+  if (sink->live && !sink->live->dirty) LiveStatsAdd(sink->live,v,n);
+}
+
+/* Attaches new live stats, as asked by the LIVEHIST and SKETCH options */
+void SampleSinkLive(SampleSink *sink, RedisModuleString *keyname, Options *opt) {
+  size_t len = sink->ss ? sink->ss->len : RedisModule_ValueLength(sink->key);
+  sink->live = LiveStatsCreate(sink->ctx,keyname,opt,len);
+}
+
+/* Pushes count samples generated by fill(buf,n) a batch at a time.
+ * Sample sets are filled in place. */
+template <class Fill>
+void SampleSinkFill(SampleSink *sink, long long count, Fill fill) {
+  double buf[SAMPLE_BATCH];
+  SampleSet *ss = sink->ss;
+  if (ss)
+  {
+    sink->stats->bytes += count*SampleWidth(ss->enc);
+    if (ss->enc == SAMPLE_F64)
+    {
+      double *v = (double *) ss->v+ss->len;
+      fill(v,count);
+      SampleSinkLiveAdd(sink,v,count);
+      ss->len += count;
+      return;
+    }
+    /* Rounded before being counted, so live stats match the key */
+    while (count > 0)
+    {
+      int n = count < SAMPLE_BATCH ? count : SAMPLE_BATCH;
+      fill(buf,n);
+      SampleSetRound(ss,buf,n);
+      SampleSinkLiveAdd(sink,buf,n);
+      SampleSetAppend(ss,buf,n);
+      count -= n;
+    }
+    return;
+  }
+  char text[SAMPLE_BATCH*SAMPLE_TEXT_MAX];
+  uint32_t ends[SAMPLE_BATCH];
+  while (count > 0)
+  {
+    int n = count < SAMPLE_BATCH ? count : SAMPLE_BATCH;
+    fill(buf,n);
+    SampleSinkLiveAdd(sink,buf,n);
+    FormatSamples(buf,n,text,ends);
+    SampleSinkPushText(sink,text,ends,n);
+    count -= n;
+  }
+}
+
+/* Closes the key and returns its length */
+size_t SampleSinkCommit(SampleSink *sink) {
+  size_t len = sink->ss ? sink->ss->len : RedisModule_ValueLength(sink->key);
+  if (sink->live && !sink->live->dirty) sink->live->len = len;
+  RedisModule_CloseKey(sink->key);
+  return len;
+}
+
+/* Closes the key and replies with its length */
+int SampleSinkClose(SampleSink *sink) {
+  return RedisModule_ReplyWithLongLong(sink->ctx, SampleSinkCommit(sink));
+}
+
+/* Pushes count samples generated by fill(eng,buf,n) and replies with the
+ * key length. The samples come from a private engine of the kind asked
+ * for, started from opt->seed, which is drawn from the shared engine when
+ * there is no SEED option, so that ReplicateSeeded can have them made
+ * again. They are written inline whatever the count: a fill spread over
+ * module threads would let other commands in between its chunks, on the
+ * master only, and replicas would not end up with the same key. */
+template <class Fill>
+void SampleSinkRun(SampleSink *sink, long long count, Options *opt, Fill fill) {
+  if (!opt->hasseed) opt->seed = (*opt->engine)();
+  curStats->samples += count;
+  Engine &eng = *seededEngines.engines[EngineIndex(opt->engine)];
+  eng.reseed(opt->seed);
+  SampleSinkFill(sink, count, [&](double *buf, size_t n) {
+    fill(eng,buf,n);
+  });
+  SampleSinkClose(sink);
+}
+
+/* Replicates an l* command given as argv[0..argc), with options from first
+ * on, as the same command with ENGINE and SEED set to what SampleSinkRun
+ * used. Replicas and AOF loading then make the same samples again, in
+ * place of receiving them all. */
+void ReplicateSeeded(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int first, Options *opt) {
+  std::vector<RedisModuleString *> args;
+  for (int i=1; i < argc; i++)
+  {
+    const char *s = RedisModule_StringPtrLen(argv[i],NULL);
+    if (i >= first && i+1 < argc && (!strcasecmp(s,"ENGINE") || !strcasecmp(s,"SEED")))
+      i++;
+    else
+      args.push_back(argv[i]);
+  }
+  RedisModuleString *engine = RedisModule_CreateString(ctx,opt->engine->name,strlen(opt->engine->name));
+  RedisModuleString *seed = RedisModule_CreateStringFromLongLong(ctx,(long long) opt->seed);
+  args.push_back(RedisModule_CreateString(ctx,"ENGINE",6));
+  args.push_back(engine);
+  args.push_back(RedisModule_CreateString(ctx,"SEED",4));
+  args.push_back(seed);
+  RedisModule_Replicate(ctx,RedisModule_StringPtrLen(argv[0],NULL),"v",args.data(),args.size());
+  for (size_t i=args.size()-4; i < args.size(); i++)
+    RedisModule_FreeString(ctx,args[i]);
+}
+
+inline int ReplyWithSample(RedisModuleCtx *ctx, double d) {
+  return RedisModule_ReplyWithDouble(ctx,d);
+}
+
+inline int ReplyWithSample(RedisModuleCtx *ctx, long long ll) {
+  return RedisModule_ReplyWithLongLong(ctx,ll);
+}
+
+/* Replies with an array of count samples, generated by fill(eng,buf,n) a
+ * batch at a time apart from the reply formatting. Large counts are
+ * generated and formatted by a worker. */
+template <class T, class Fill>
+int ReplyWithSamples(RedisModuleCtx *ctx, long long count, Engine *eng, Fill fill) {
+  curStats->samples += count;
+  auto reply = [=](RedisModuleCtx *ctx, Engine &eng) {
+    T buf[SAMPLE_BATCH];
+    long long left = count;
+    RedisModule_ReplyWithArray(ctx,left);
+    while (left > 0)
+    {
+      int n = left < SAMPLE_BATCH ? left : SAMPLE_BATCH;
+      fill(eng,buf,n);
+      for (int i=0; i < n; i++)
+        ReplyWithSample(ctx,buf[i]);
+      left -= n;
+    }
+  };
+  if (!RunAsync(ctx,count,eng,reply)) reply(ctx,*eng);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.DUNIF START END [COUNT n] [ENGINE name] */
 int RandomDUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_COUNT | OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 3) return RedisModule_WrongArity(ctx);
+  long long start, end;
+  if (
+      (RedisModule_StringToLongLong(argv[1],&start) != REDISMODULE_OK) ||
+      (RedisModule_StringToLongLong(argv[2],&end) != REDISMODULE_OK) ||
+      (start > end) 
+      ) 
+    return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+
+  Engine &eng = *opt.engine;
+  uint64_t range = (uint64_t) end - (uint64_t) start + 1;
+  if (opt.count >= 0)
+    return ReplyWithSamples<long long>(ctx,opt.count,opt.engine,[=](Engine &eng, long long *buf, int n) {
+      DUnifFill(eng,buf,n,start,range);
+    });
+  curStats->samples++;
+  RingSlot s;
+  uint64_t w = RingPop(RING_WORD,opt.engine,&s) ? s.w : eng();
+  RedisModule_ReplyWithLongLong(ctx,(long long) ((uint64_t) start + BoundedWord(eng,w,range)));
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.LDUNIF KEY COUNT START END [PACKED] [ENGINE name]
+ *   [LIVEHIST cells min max] [SKETCH alpha] [SEED s] [TAIL]
+ * START and END within 2^53, as samples are stored as doubles */
+int RandomLDUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  long long start, end;
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_PACKED | OPT_ENCODING | OPT_ENGINE | OPT_LIVEHIST | OPT_SKETCH | OPT_SEED | OPT_TAIL, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 5) return RedisModule_WrongArity(ctx);
+  if ((RedisModule_StringToLongLong(argv[3],&start) != REDISMODULE_OK) ||
+      (RedisModule_StringToLongLong(argv[4],&end) != REDISMODULE_OK) ||
+      (start > end) || (start < -(1LL<<53)) || (end > (1LL<<53)))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+
+  /* Open key, must be empty, list or sample set */
+  SampleSink sink;
+  if (SampleSinkOpen(ctx, argv[1], &opt, &sink) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+
+  /* Get count */
+  long long count;
+  if ((RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK) ||
+        (count < 0))
+  {
+     RedisModule_CloseKey(sink.key);
+     return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  }
+  SampleSinkReserve(&sink, count);
+  if (opt.livecells || opt.alpha) SampleSinkLive(&sink, argv[1], &opt);
+
+  /* Push count randoms */
+  uint64_t range = (uint64_t) end - (uint64_t) start + 1;
+  SampleSinkRun(&sink, count, &opt, [=](Engine &eng, double *buf, size_t n) {
+    DUnifFill(eng,buf,n,start,range);
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* Largest K of RANDOM.DSAMPLE and RANDOM.PICK, whose picks are all held
+ * in memory, some 50 bytes each, while they are made */
+#define PICK_MAX_K (1LL<<24)
+
+/* k distinct integers in [0,range), range 0 standing for 2^64, in random
+ * order. Floyd's algorithm picks them in O(k) time and memory whatever the
+ * size of the range, and a shuffle puts them in random order. */
+void FloydPick(Engine &eng, uint64_t range, uint64_t k, std::vector<uint64_t> &picked) {
+  /* For j in [range-k,range): pick t in [0,j], taking j if t is taken */
+  std::unordered_set<uint64_t> taken;
+  picked.clear();
+  picked.reserve(k);
+  taken.reserve(k);
+  for (uint64_t j=range-k; j != range; j++)
+  {
+    uint64_t t = BoundedWord(eng,eng(),j+1);
+    if (!taken.insert(t).second)
+    {
+      t = j;
+      taken.insert(t);
+    }
+    picked.push_back(t);
+  }
+  for (size_t i=picked.size(); i > 1; i--)
+    std::swap(picked[i-1],picked[BoundedWord(eng,eng(),i)]);
+}
+
+/* RANDOM.DSAMPLE START END K [ENGINE name]
+ * K distinct integers in [START,END], in random order */
+int RandomDSample_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 4, OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 4) return RedisModule_WrongArity(ctx);
+  long long start, end, k;
+  if ((RedisModule_StringToLongLong(argv[1],&start) != REDISMODULE_OK) ||
+      (RedisModule_StringToLongLong(argv[2],&end) != REDISMODULE_OK) ||
+      (start > end))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+  /* Values in the range, 0 for all 2^64 */
+  uint64_t range = (uint64_t) end - (uint64_t) start + 1;
+  if ((RedisModule_StringToLongLong(argv[3],&k) != REDISMODULE_OK) ||
+      (k < 0) || k > PICK_MAX_K || (range != 0 && (uint64_t) k > range))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+
+  curStats->samples += k;
+  auto reply = [=](RedisModuleCtx *ctx, Engine &eng) {
+    std::vector<uint64_t> picked;
+    FloydPick(eng,range,k,picked);
+    RedisModule_ReplyWithArray(ctx,k);
+    for (uint64_t t : picked)
+      RedisModule_ReplyWithLongLong(ctx,(long long) ((uint64_t) start + t));
+  };
+  if (!RunAsync(ctx,k,opt.engine,reply)) reply(ctx,*opt.engine);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.UNIF START END [COUNT n] [ENGINE name] */
+int RandomUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_COUNT | OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 3) return RedisModule_WrongArity(ctx);
+  double start, end;
+  if (
+      (RedisModule_StringToDouble(argv[1],&start) != REDISMODULE_OK) ||
+      (RedisModule_StringToDouble(argv[2],&end) != REDISMODULE_OK) ||
+      (start > end) 
+      ) 
+    return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+
+  Engine &eng = *opt.engine;
+  if (opt.count >= 0)
+    return ReplyWithSamples<double>(ctx,opt.count,opt.engine,[=](Engine &eng, double *buf, int n) {
+      UniformFill(eng,buf,n,start,end);
+    });
+  curStats->samples++;
+  RingSlot s;
+  uint64_t w = RingPop(RING_WORD,opt.engine,&s) ? s.w : eng();
+  RedisModule_ReplyWithDouble(ctx,start + (end-start)*WordToUnit(w));
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.NORM [MEAN=0.0] [STDDEV=1.0] [COUNT n] [ENGINE name] */
+int RandomNorm_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  double mean=0.0, sd=1.0;
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 1, OPT_COUNT | OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc > 3) return RedisModule_WrongArity(ctx);
+  if (argc >= 2) /* Get mean */
+  {
+    if (RedisModule_StringToDouble(argv[1],&mean) != REDISMODULE_OK)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid mean");
+  }
+  if (argc == 3) /* get stddev */
+  {
+    if (RedisModule_StringToDouble(argv[2],&sd) != REDISMODULE_OK)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid standard deviation");
+  }
+
+  Engine &eng = *opt.engine;
+  if (opt.count >= 0)
+    return ReplyWithSamples<double>(ctx,opt.count,opt.engine,[=](Engine &eng, double *buf, int n) {
+      NormalFill(eng,buf,n,mean,sd);
+    });
+  curStats->samples++;
+  RingSlot s;
+  double z = RingPop(RING_NORM,opt.engine,&s) ? s.d : ZigNormal(eng,eng());
+  RedisModule_ReplyWithDouble(ctx, mean + sd*z);
+  return REDISMODULE_OK;
+}
+/* RANDOM.LUNIF KEY COUNT START END [PACKED] [ENGINE name]
+ *   [LIVEHIST cells min max] [SKETCH alpha] [SEED s] [TAIL] */
+int RandomLUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  double start, end;
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_PACKED | OPT_ENCODING | OPT_ENGINE | OPT_LIVEHIST | OPT_SKETCH | OPT_SEED | OPT_TAIL, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 5) return RedisModule_WrongArity(ctx);
+  if (RedisModule_StringToDouble(argv[3],&start) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid start");
+  if (RedisModule_StringToDouble(argv[4],&end) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid end");
+
+  /* Open key, must be empty, list or sample set */
+  SampleSink sink;
+  if (SampleSinkOpen(ctx, argv[1], &opt, &sink) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+
+  /* Get count */
+  long long count;
+  if ((RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK) ||
+        (count < 0)) 
+  {
+     RedisModule_CloseKey(sink.key);
+     return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  }
+  SampleSinkReserve(&sink, count);
+  if (opt.livecells || opt.alpha) SampleSinkLive(&sink, argv[1], &opt);
+
+  /* Push count randoms */
+  SampleSinkRun(&sink, count, &opt, [=](Engine &eng, double *buf, size_t n) {
+    UniformFill(eng,buf,n,start,end);
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.LNORM KEY COUNT [MEAN=0.0] [STDDEV=1.0] [PACKED] [ENGINE name]
+ *   [LIVEHIST cells min max] [SKETCH alpha] [SEED s] [TAIL] */
+int RandomLNorm_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  double mean=0.0, sd=1.0;
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_PACKED | OPT_ENCODING | OPT_ENGINE | OPT_LIVEHIST | OPT_SKETCH | OPT_SEED | OPT_TAIL, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 3 || argc > 5) return RedisModule_WrongArity(ctx);
+  if (argc >= 4) /* Get mean */
+  {
+    if (RedisModule_StringToDouble(argv[3],&mean) != REDISMODULE_OK)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid mean");
+  }
+  if (argc == 5) /* get stddev */
+  {
+    if (RedisModule_StringToDouble(argv[4],&sd) != REDISMODULE_OK)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid standard deviation");
+  }
+
+  /* Open key, must be empty, list or sample set */
+  SampleSink sink;
+  if (SampleSinkOpen(ctx, argv[1], &opt, &sink) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+
+  /* Get count */
+  long long count;
+  if ((RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK) ||
+        (count < 0)) 
+  {
+     RedisModule_CloseKey(sink.key);
+     return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  }
+  SampleSinkReserve(&sink, count);
+  if (opt.livecells || opt.alpha) SampleSinkLive(&sink, argv[1], &opt);
+
+  /* Push count randoms */
+  SampleSinkRun(&sink, count, &opt, [=](Engine &eng, double *buf, size_t n) {
+    NormalFill(eng,buf,n,mean,sd);
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.EXP [LAMBDA=1.0] [COUNT n] [ENGINE name] */
+int RandomExp_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  double lambda;
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 1, OPT_COUNT | OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc > 2) return RedisModule_WrongArity(ctx);
+  if (argc == 2)
+  {
+    if (RedisModule_StringToDouble(argv[1],&lambda) != REDISMODULE_OK)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid lambda");
+  }
+  else // If no parameter, use default lambda of 1
+    lambda=1.0;
+  Engine &eng = *opt.engine;
+  if (opt.count >= 0)
+    return ReplyWithSamples<double>(ctx,opt.count,opt.engine,[=](Engine &eng, double *buf, int n) {
+      ExpFill(eng,buf,n,lambda);
+    });
+  curStats->samples++;
+  RingSlot s;
+  double e = RingPop(RING_EXP,opt.engine,&s) ? s.d : ZigExp(eng,eng());
+  RedisModule_ReplyWithDouble(ctx, e/lambda);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.LEXP KEY COUNT [LAMBDA=1.0] [PACKED] [ENGINE name]
+ *   [LIVEHIST cells min max] [SKETCH alpha] [SEED s] [TAIL] */
+int RandomLExp_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  double lambda;
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_PACKED | OPT_ENCODING | OPT_ENGINE | OPT_LIVEHIST | OPT_SKETCH | OPT_SEED | OPT_TAIL, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 3 || argc > 4) return RedisModule_WrongArity(ctx);
+  if (argc == 4)
+  {
+    if (RedisModule_StringToDouble(argv[3],&lambda) != REDISMODULE_OK)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid lambda");
+  }
+  else // If no parameter, use default lambda of 1
+    lambda=1.0;
+
+  /* Open key, must be empty, list or sample set */
+  SampleSink sink;
+  if (SampleSinkOpen(ctx, argv[1], &opt, &sink) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+
+  /* Get count */
+  long long count;
+  if ((RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK) ||
+        (count < 0)) 
+  {
+     RedisModule_CloseKey(sink.key);
+     return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  }
+  SampleSinkReserve(&sink, count);
+  if (opt.livecells || opt.alpha) SampleSinkLive(&sink, argv[1], &opt);
+
+  /* Push count randoms */
+  SampleSinkRun(&sink, count, &opt, [=](Engine &eng, double *buf, size_t n) {
+    ExpFill(eng,buf,n,lambda);
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* Sorted samples
+ * The z* commands add samples to a sorted set in ascending order, with the
+ * samples as scores and members numbered on from the size of the set. No
+ * sort is needed: with E1..En+1 standard exponentials and S their sum,
+ * (E1+...+Ei)/S for i=1..n are the n uniforms on (0,1) in order. They are
+ * made in two passes over the same words, the first for S, so memory does
+ * not grow with COUNT, and mapped to other distributions by their inverse
+ * distribution functions, which keep the order. */
+
+/* Order statistics of count uniforms. The spacings are drawn SAMPLE_BATCH
+ * at a time in both passes, whatever batches are asked for, as the words
+ * taken by rejections depend on the batches. */
+struct SortedUnif {
+  double sum;                  /* of the count+1 spacings */
+  double at;                   /* of the spacings so far */
+  long long left;              /* spacings not drawn yet, the last left out */
+  double buf[SAMPLE_BATCH];
+  size_t pos, len;
+};
+
+/* Draws the next batch of spacings into su->buf */
+void SortedUnifNext(SortedUnif *su, Engine &eng) {
+  su->len = su->left < SAMPLE_BATCH ? su->left : SAMPLE_BATCH;
+  ExpFill(eng,su->buf,su->len,1.0);
+  su->left -= su->len;
+  su->pos = 0;
+}
+
+/* Takes the first pass, and starts eng over for the second */
+void SortedUnifStart(SortedUnif *su, Engine &eng, uint64_t seed, long long count) {
+  eng.reseed(seed);
+  su->sum = 0;
+  su->left = count;
+  while (su->left > 0)
+  {
+    SortedUnifNext(su,eng);
+    for (size_t i=0; i < su->len; i++) su->sum += su->buf[i];
+  }
+  double last;
+  ExpFill(eng,&last,1,1.0);
+  su->sum += last;
+  eng.reseed(seed);
+  su->at = 0;
+  su->left = count;
+  su->pos = su->len = 0;
+}
+
+void SortedUnifFill(SortedUnif *su, Engine &eng, double *out, size_t n) {
+  for (size_t i=0; i < n; i++)
+  {
+    if (su->pos == su->len) SortedUnifNext(su,eng);
+    su->at += su->buf[su->pos++];
+    /* Below 1 unless the last spacing is lost in rounding */
+    out[i] = std::min(su->at/su->sum,1-DBL_EPSILON/2);
+  }
+}
+
+/* Inverse of the standard normal distribution, Wichura's AS241, good to
+ * about 1e-16 */
+double NormalQuantile(double p) {
+  double q = p-0.5;
+  if (std::fabs(q) <= 0.425)
+  {
+    double r = 0.180625-q*q;
+    return q*(((((((2509.0809287301226727*r+33430.575583588128105)*r+
+      67265.770927008700853)*r+45921.953931549871457)*r+13731.693765509461125)*r+
+      1971.5909503065514427)*r+133.14166789178437745)*r+3.387132872796366608)/
+      (((((((5226.495278852545925*r+28729.085735721942674)*r+
+      39307.89580009271061)*r+21213.794301586595867)*r+5394.1960214247511077)*r+
+      687.1870074920579083)*r+42.313330701600911252)*r+1.0);
+  }
+  double r = q < 0 ? p : 1-p;
+  if (r <= 0) return q < 0 ? -INFINITY : INFINITY;
+  r = std::sqrt(-std::log(r));
+  double x;
+  if (r <= 5)
+  {
+    r -= 1.6;
+    x = (((((((7.7454501427834140764e-4*r+0.0227238449892691845833)*r+
+      0.24178072517745061177)*r+1.27045825245236838258)*r+3.64784832476320460504)*r+
+      5.7694972214606914055)*r+4.6303378461565452959)*r+1.42343711074968357734)/
+      (((((((1.05075007164441684324e-9*r+5.475938084995344946e-4)*r+
+      0.0151986665636164571966)*r+0.14810397642748007459)*r+0.68976733498510000455)*r+
+      1.6763848301838038494)*r+2.05319162663775882187)*r+1.0);
+  }
+  else
+  {
+    r -= 5;
+    x = (((((((2.01033439929228813265e-7*r+2.71155556874348757815e-5)*r+
+      0.0012426609473880784386)*r+0.026532189526576123093)*r+0.29656057182850489123)*r+
+      1.7848265399172913358)*r+5.4637849111641143699)*r+6.6579046435011037772)/
+      (((((((2.04426310338993978564e-15*r+1.4215117583164458887e-7)*r+
+      1.8463183175100546818e-5)*r+7.868691311456132591e-4)*r+0.0148753612908506148525)*r+
+      0.13692988092273580531)*r+0.59983220655588793769)*r+1.0);
+  }
+  return q < 0 ? -x : x;
+}
+
+/* Adds samples v as new members of the sorted set at key, numbered from
+ * *id on. Numbers taken by members already there, such as those left
+ * after a ZREM, are skipped, so no score is overwritten. */
+void ZSampleAdd(RedisModuleCtx *ctx, RedisModuleKey *key, long long *id, const double *v, size_t n) {
+  for (size_t i=0; i < n; i++)
+  {
+    int flags;
+    do
+    {
+      RedisModuleString *member = RedisModule_CreateStringFromLongLong(ctx,(*id)++);
+      flags = REDISMODULE_ZADD_NX;
+      if (RedisModule_ZsetAdd(key,v[i],member,&flags) != REDISMODULE_OK) flags = 0;
+      RedisModule_FreeString(ctx,member);
+    } while (flags & REDISMODULE_ZADD_NOP);
+  }
+}
+
+/* Adds count sorted uniforms, mapped by map(v,n) in place, to the sorted set
+ * at keyname and replies with its size. Added inline, like the l*
+ * commands. */
+template <class Map>
+void ZSampleRun(RedisModuleCtx *ctx, RedisModuleString *keyname, long long count, Options *opt, Map map) {
+  if (!opt->hasseed) opt->seed = (*opt->engine)();
+  curStats->samples += count;
+  Engine &eng = *seededEngines.engines[EngineIndex(opt->engine)];
+  SortedUnif su;
+  SortedUnifStart(&su,eng,opt->seed,count);
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ | REDISMODULE_WRITE);
+  long long id = RedisModule_ValueLength(key);
+  double buf[SAMPLE_BATCH];
+  for (long long done=0; done < count; )
+  {
+    size_t n = count-done < SAMPLE_BATCH ? count-done : SAMPLE_BATCH;
+    SortedUnifFill(&su,eng,buf,n);
+    map(buf,n);
+    ZSampleAdd(ctx,key,&id,buf,n);
+    done += n;
+  }
+  RedisModule_ReplyWithLongLong(ctx,RedisModule_ValueLength(key));
+  RedisModule_CloseKey(key);
+}
+
+/* Checks that KEY can take the samples of a z* command, or replies with
+ * an error */
+int ZSampleCheck(RedisModuleCtx *ctx, RedisModuleString *keyname) {
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ);
+  int type = RedisModule_KeyType(key);
+  RedisModule_CloseKey(key);
+  if (type == REDISMODULE_KEYTYPE_EMPTY || type == REDISMODULE_KEYTYPE_ZSET)
+    return REDISMODULE_OK;
+  RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  return REDISMODULE_ERR;
+}
+
+/* RANDOM.ZUNIF KEY COUNT START END [ENGINE name] [SEED s]
+ * Adds COUNT uniform samples in [START,END) to the sorted set KEY */
+int RandomZUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_ENGINE | OPT_SEED, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 5) return RedisModule_WrongArity(ctx);
+  long long count;
+  double a, b;
+  if (RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK || count < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  if (RedisModule_StringToDouble(argv[3],&a) != REDISMODULE_OK ||
+      RedisModule_StringToDouble(argv[4],&b) != REDISMODULE_OK || !(a <= b))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+  if (ZSampleCheck(ctx,argv[1]) != REDISMODULE_OK) return REDISMODULE_OK;
+
+  ZSampleRun(ctx, argv[1], count, &opt, [=](double *v, size_t n) {
+    for (size_t i=0; i < n; i++) v[i] = a+(b-a)*v[i];
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.ZNORM KEY COUNT [MEAN=0.0] [STDDEV=1.0] [ENGINE name] [SEED s]
+ * Adds COUNT normal samples to the sorted set KEY */
+int RandomZNorm_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_ENGINE | OPT_SEED, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 3 || argc > 5) return RedisModule_WrongArity(ctx);
+  long long count;
+  double mean = 0.0, sd = 1.0;
+  if (RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK || count < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  if (argc >= 4 && RedisModule_StringToDouble(argv[3],&mean) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid mean");
+  if (argc == 5 && (RedisModule_StringToDouble(argv[4],&sd) != REDISMODULE_OK || sd < 0))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid stddev");
+  if (ZSampleCheck(ctx,argv[1]) != REDISMODULE_OK) return REDISMODULE_OK;
+
+  ZSampleRun(ctx, argv[1], count, &opt, [=](double *v, size_t n) {
+    for (size_t i=0; i < n; i++) v[i] = mean+sd*NormalQuantile(v[i]);
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.ZEXP KEY COUNT [LAMBDA=1.0] [ENGINE name] [SEED s]
+ * Adds COUNT exponential samples to the sorted set KEY */
+int RandomZExp_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_ENGINE | OPT_SEED, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 3 || argc > 4) return RedisModule_WrongArity(ctx);
+  long long count;
+  double lambda = 1.0;
+  if (RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK || count < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  if (argc == 4 && (RedisModule_StringToDouble(argv[3],&lambda) != REDISMODULE_OK || !(lambda > 0)))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid lambda");
+  if (ZSampleCheck(ctx,argv[1]) != REDISMODULE_OK) return REDISMODULE_OK;
+
+  ZSampleRun(ctx, argv[1], count, &opt, [=](double *v, size_t n) {
+    for (size_t i=0; i < n; i++) v[i] = -std::log1p(-v[i])/lambda;
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* Secure bytes and tokens
+ * RANDOM.BYTES and RANDOM.TOKEN draw from a ChaCha20 engine of their own,
+ * keyed with 256 bits from the random device and keyed again every
+ * SECURE_REKEY words, so nothing they give away can be learnt from other
+ * commands, or tells what they gave before. Tokens take a byte per
+ * character, bytes that would make some characters likelier being thrown
+ * away. */
+#define SECURE_REKEY (1<<20)
+
+/* Longest string of RANDOM.BYTES and RANDOM.TOKEN */
+#define SECURE_MAX_LEN (1<<20)
+
+struct SecureRandom {
+  ChaChaEngine eng;
+  uint64_t used;    /* words since the last key */
+  uint64_t w;       /* word the bytes are taken from */
+  int left;         /* bytes of w not taken yet */
+};
+
+SecureRandom secureRandom;
+
+void SecureRekey(SecureRandom *sr, const uint32_t k[8]) {
+  sr->eng.rekey(k);
+  sr->used = 0;
+  sr->left = 0;
+}
+
+/* Keys from the random device, for the engine of the main thread */
+void SecureRekey() {
+  uint32_t k[8];
+  for (int i=0; i < 8; i++) k[i] = rd();
+  SecureRekey(&secureRandom,k);
+}
+
+/* A key for the engine of a worker job, taken from the stream of sr */
+void SecureDerive(SecureRandom *sr, uint32_t k[8]) {
+  uint64_t w[4];
+  sr->eng.words(w,4);
+  sr->used += 4;
+  for (int i=0; i < 4; i++)
+  {
+    k[2*i] = (uint32_t) w[i];
+    k[2*i+1] = (uint32_t) (w[i] >> 32);
+  }
+}
+
+/* Called by each command, so a key is not kept for long past its quota.
+ * Workers have no use of the random device, and key their job engines
+ * again from their own stream. */
+inline void SecureCheck() {
+  if (secureRandom.used >= SECURE_REKEY) SecureRekey();
+}
+
+inline void SecureCheck(SecureRandom *sr) {
+  if (sr->used < SECURE_REKEY) return;
+  uint32_t k[8];
+  SecureDerive(sr,k);
+  SecureRekey(sr,k);
+}
+
+void SecureBytes(SecureRandom *sr, char *out, size_t n) {
+  uint64_t buf[ENGINE_BUFFER];
+  while (n > 0)
+  {
+    size_t m = n < sizeof(buf) ? n : sizeof(buf);
+    size_t words = (m+7)/8;
+    sr->eng.words(buf,words);
+    sr->used += words;
+    for (size_t i=0; i < m; i++)
+      out[i] = (char) (buf[i/8] >> (8*(i%8)));
+    out += m;
+    n -= m;
+  }
+}
+
+/* Characters of a token by byte, or -1 for the bytes thrown away */
+struct TokenAlphabet {
+  int chars[256];
+};
+
+void TokenAlphabetInit(TokenAlphabet *ta, const char *p, size_t m) {
+  size_t keep = 256 - 256 % m;
+  for (size_t b=0; b < 256; b++)
+    ta->chars[b] = b < keep ? (unsigned char) p[b % m] : -1;
+}
+
+/* The byte state is kept in locals, as writes through out could change
+ * sr for all the compiler knows */
+void TokenFill(SecureRandom *sr, const TokenAlphabet *ta, char *out, size_t len) {
+  uint64_t w = sr->w;
+  int left = sr->left;
+  for (size_t i=0; i < len; )
+  {
+    if (left == 0)
+    {
+      w = sr->eng();
+      sr->used++;
+      left = 8;
+    }
+    int c = ta->chars[w & 0xFF];
+    w >>= 8;
+    left--;
+    if (c >= 0) out[i++] = (char) c;
+  }
+  sr->w = w;
+  sr->left = left;
+}
+
+/* URL safe base64, 6 bits a character */
+static const char TokenDefault[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* Replies with count strings of len bytes made by fill(sr,buf,len). Large
+ * replies, counted in words of the engine, are made by a worker from an
+ * engine of the job's own, keyed from secureRandom, which the workers
+ * never touch. */
+template <class Fill>
+void ReplyWithSecure(RedisModuleCtx *ctx, long long count, long long len, Fill fill) {
+  const long long big = std::numeric_limits<long long>::max();
+  long long words = (len+7)/8+1;
+  long long work = count > big/words ? big : count*words;
+  uint32_t k[8];
+  SecureDerive(&secureRandom,k);
+  auto reply = [=](RedisModuleCtx *ctx, Engine &) {
+    SecureRandom sr;
+    SecureRekey(&sr,k);
+    std::vector<char> buf(len);
+    RedisModule_ReplyWithArray(ctx,count);
+    for (long long i=0; i < count; i++)
+    {
+      SecureCheck(&sr);
+      fill(&sr,buf.data(),len);
+      RedisModule_ReplyWithStringBuffer(ctx,buf.data(),len);
+    }
+  };
+  if (!RunAsync(ctx,work,defaultEngine,reply)) reply(ctx,*defaultEngine);
+  curStats->bytes += len*count;
+}
+
+/* RANDOM.BYTES N [COUNT n]
+ * N secure random bytes, or COUNT strings of them */
+int RandomBytes_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_COUNT, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 2) return RedisModule_WrongArity(ctx);
+  long long n;
+  if (RedisModule_StringToLongLong(argv[1],&n) != REDISMODULE_OK || n < 0 || n > SECURE_MAX_LEN)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid length");
+
+  SecureCheck();
+  if (opt.count < 0)
+  {
+    std::vector<char> buf(n);
+    SecureBytes(&secureRandom,buf.data(),n);
+    curStats->bytes += n;
+    return RedisModule_ReplyWithStringBuffer(ctx,buf.data(),n);
+  }
+  ReplyWithSecure(ctx, opt.count, n, [](SecureRandom *sr, char *out, size_t n) {
+    SecureBytes(sr,out,n);
+  });
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.TOKEN LEN [ALPHABET] [COUNT n]
+ * A secure random token of LEN characters of ALPHABET, URL safe base64 by
+ * default, or COUNT of them */
+int RandomToken_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_COUNT, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 2 || argc > 3) return RedisModule_WrongArity(ctx);
+  long long len;
+  if (RedisModule_StringToLongLong(argv[1],&len) != REDISMODULE_OK || len < 0 || len > SECURE_MAX_LEN)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid length");
+  const char *p = TokenDefault;
+  size_t m = sizeof(TokenDefault)-1;
+  if (argc == 3)
+  {
+    p = RedisModule_StringPtrLen(argv[2],&m);
+    if (m < 2 || m > 256)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid alphabet");
+  }
+
+  SecureCheck();
+  TokenAlphabet ta;
+  TokenAlphabetInit(&ta,p,m);
+  if (opt.count < 0)
+  {
+    std::vector<char> buf(len);
+    TokenFill(&secureRandom,&ta,buf.data(),len);
+    curStats->bytes += len;
+    return RedisModule_ReplyWithStringBuffer(ctx,buf.data(),len);
+  }
+  ReplyWithSecure(ctx, opt.count, len, [ta](SecureRandom *sr, char *out, size_t n) {
+    TokenFill(sr,&ta,out,n);
+  });
+  return REDISMODULE_OK;
+}
+
+/* Low discrepancy sequences
+ * RANDOM.SOBOL and RANDOM.HALTON give points of DIM coordinates in [0,1)
+ * that cover the unit cube more evenly than randoms, so Monte Carlo
+ * estimates made with them converge faster. Sobol points come in Gray code
+ * order, so each is made from the one before with a XOR of one direction
+ * number per coordinate. Halton coordinates are the digits of the point
+ * index in base of the first DIM primes, reversed; they are kept as
+ * integers over a power of the base, so stepping to the next point only
+ * touches the digits that change, exactly. SCRAMBLE randomizes the points
+ * and keeps them as even: Sobol coordinates get Owen's nested scrambling,
+ * by the Laine-Karras hash of Burley's method, and Halton digits a random
+ * permutation per dimension, with 0 kept. NORM and EXP map coordinates,
+ * taken at the centre of their cell so that they are never 0, through the
+ * inverse normal and exponential distributions. */
+#define SOBOL_MAX_DIM 128
+#define SOBOL_MAX_DEGREE 10
+#define SOBOL_BITS 32
+#define HALTON_MAX_DIM 128
+
+/* Joe and Kuo's primitive polynomials and initial direction numbers
+ * m1..md, for dimensions 2 and on (new-joe-kuo-6.21201). Polynomials are
+ * given with the bits of all their coefficients, d being the highest. */
+static const uint16_t SobolPoly[SOBOL_MAX_DIM-1] = {
+  3,7,11,13,19,25,37,41,47,55,59,61,
+  67,91,97,103,109,115,131,137,143,145,157,167,
+  171,185,191,193,203,211,213,229,239,241,247,253,
+  285,299,301,333,351,355,357,361,369,391,397,425,
+  451,463,487,501,529,539,545,557,563,601,607,617,
+  623,631,637,647,661,675,677,687,695,701,719,721,
+  731,757,761,787,789,799,803,817,827,847,859,865,
+  875,877,883,895,901,911,949,953,967,971,973,981,
+  985,995,1001,1019,1033,1051,1063,1069,1125,1135,1153,1163,
+  1221,1239,1255,1267,1279,1293,1305,1315,1329,1341,1347,1367,
+  1387,1413,1423,1431,1441,1479,1509
+};
+
+static const uint16_t SobolInit[SOBOL_MAX_DIM-1][SOBOL_MAX_DEGREE] = {
+  {1},
+  {1,3},
+  {1,3,1},
+  {1,1,1},
+  {1,1,3,3},
+  {1,3,5,13},
+  {1,1,5,5,17},
+  {1,1,5,5,5},
+  {1,1,7,11,19},
+  {1,1,5,1,1},
+  {1,1,1,3,11},
+  {1,3,5,5,31},
+  {1,3,3,9,7,49},
+  {1,1,1,15,21,21},
+  {1,3,1,13,27,49},
+  {1,1,1,15,7,5},
+  {1,3,1,15,13,25},
+  {1,1,5,5,19,61},
+  {1,3,7,11,23,15,103},
+  {1,3,7,13,13,15,69},
+  {1,1,3,13,7,35,63},
+  {1,3,5,9,1,25,53},
+  {1,3,1,13,9,35,107},
+  {1,3,1,5,27,61,31},
+  {1,1,5,11,19,41,61},
+  {1,3,5,3,3,13,69},
+  {1,1,7,13,1,19,1},
+  {1,3,7,5,13,19,59},
+  {1,1,3,9,25,29,41},
+  {1,3,5,13,23,1,55},
+  {1,3,7,3,13,59,17},
+  {1,3,1,3,5,53,69},
+  {1,1,5,5,23,33,13},
+  {1,1,7,7,1,61,123},
+  {1,1,7,9,13,61,49},
+  {1,3,3,5,3,55,33},
+  {1,3,1,15,31,13,49,245},
+  {1,3,5,15,31,59,63,97},
+  {1,3,1,11,11,11,77,249},
+  {1,3,1,11,27,43,71,9},
+  {1,1,7,15,21,11,81,45},
+  {1,3,7,3,25,31,65,79},
+  {1,3,1,1,19,11,3,205},
+  {1,1,5,9,19,21,29,157},
+  {1,3,7,11,1,33,89,185},
+  {1,3,3,3,15,9,79,71},
+  {1,3,7,11,15,39,119,27},
+  {1,1,3,1,11,31,97,225},
+  {1,1,1,3,23,43,57,177},
+  {1,3,7,7,17,17,37,71},
+  {1,3,1,5,27,63,123,213},
+  {1,1,3,5,11,43,53,133},
+  {1,3,5,5,29,17,47,173,479},
+  {1,3,3,11,3,1,109,9,69},
+  {1,1,1,5,17,39,23,5,343},
+  {1,3,1,5,25,15,31,103,499},
+  {1,1,1,11,11,17,63,105,183},
+  {1,1,5,11,9,29,97,231,363},
+  {1,1,5,15,19,45,41,7,383},
+  {1,3,7,7,31,19,83,137,221},
+  {1,1,1,3,23,15,111,223,83},
+  {1,1,5,13,31,15,55,25,161},
+  {1,1,3,13,25,47,39,87,257},
+  {1,1,1,11,21,53,125,249,293},
+  {1,1,7,11,11,7,57,79,323},
+  {1,1,5,5,17,13,81,3,131},
+  {1,1,7,13,23,7,65,251,475},
+  {1,3,5,1,9,43,3,149,11},
+  {1,1,3,13,31,13,13,255,487},
+  {1,3,3,1,5,63,89,91,127},
+  {1,1,3,3,1,19,123,127,237},
+  {1,1,5,7,23,31,37,243,289},
+  {1,1,5,11,17,53,117,183,491},
+  {1,1,1,5,1,13,13,209,345},
+  {1,1,3,15,1,57,115,7,33},
+  {1,3,1,11,7,43,81,207,175},
+  {1,3,1,1,15,27,63,255,49},
+  {1,3,5,3,27,61,105,171,305},
+  {1,1,5,3,1,3,57,249,149},
+  {1,1,3,5,5,57,15,13,159},
+  {1,1,1,11,7,11,105,141,225},
+  {1,3,3,5,27,59,121,101,271},
+  {1,3,5,9,11,49,51,59,115},
+  {1,1,7,1,23,45,125,71,419},
+  {1,1,3,5,23,5,105,109,75},
+  {1,1,7,15,7,11,67,121,453},
+  {1,3,7,3,9,13,31,27,449},
+  {1,3,1,15,19,39,39,89,15},
+  {1,1,1,1,1,33,73,145,379},
+  {1,3,1,15,15,43,29,13,483},
+  {1,1,7,3,19,27,85,131,431},
+  {1,3,3,3,5,35,23,195,349},
+  {1,3,3,7,9,27,39,59,297},
+  {1,1,3,9,11,17,13,241,157},
+  {1,3,7,15,25,57,33,189,213},
+  {1,1,7,1,9,55,73,83,217},
+  {1,3,3,13,19,27,23,113,249},
+  {1,3,5,3,23,43,3,253,479},
+  {1,1,5,5,11,5,45,117,217},
+  {1,3,3,7,29,37,33,123,147},
+  {1,3,1,15,5,5,37,227,223,459},
+  {1,1,7,5,5,39,63,255,135,487},
+  {1,3,1,7,9,7,87,249,217,599},
+  {1,1,3,13,9,47,7,225,363,247},
+  {1,3,7,13,19,13,9,67,9,737},
+  {1,3,5,5,19,59,7,41,319,677},
+  {1,1,5,3,31,63,15,43,207,789},
+  {1,1,7,9,13,39,3,47,497,169},
+  {1,3,1,7,21,17,97,19,415,905},
+  {1,3,7,1,3,31,71,111,165,127},
+  {1,1,5,11,1,61,83,119,203,847},
+  {1,3,3,13,9,61,19,97,47,35},
+  {1,1,7,7,15,29,63,95,417,469},
+  {1,3,1,9,25,9,71,57,213,385},
+  {1,3,5,13,31,47,101,57,39,341},
+  {1,1,3,3,31,57,125,173,365,551},
+  {1,3,7,1,13,57,67,157,451,707},
+  {1,1,1,7,21,13,105,89,429,965},
+  {1,1,5,9,17,51,45,119,157,141},
+  {1,3,7,7,13,45,91,9,129,741},
+  {1,3,7,1,23,57,67,141,151,571},
+  {1,1,3,11,17,47,93,107,375,157},
+  {1,3,3,5,11,21,43,51,169,915},
+  {1,1,5,3,15,55,101,67,455,625},
+  {1,3,5,9,1,23,29,47,345,595},
+  {1,3,7,7,5,49,29,155,323,589},
+  {1,3,3,7,5,41,127,61,261,717}
+};
+
+enum {QRNG_SOBOL, QRNG_HALTON};
+
+struct Qrng {
+  int kind;
+  int dim;
+  int inverse;                  /* OPT_NORM, OPT_EXP or 0 */
+  double invp[2];
+  uint64_t index;               /* of the next point */
+  std::vector<double> point;    /* the last point made */
+  size_t pos;                   /* its coordinates handed out */
+  /* Sobol */
+  std::vector<uint32_t> v;      /* SOBOL_BITS direction numbers a dimension */
+  std::vector<uint32_t> x;
+  std::vector<uint32_t> seeds;  /* of the scrambling, 0 if not scrambled */
+  /* Halton, 64 digits a dimension */
+  std::vector<uint32_t> base;
+  std::vector<int> ndigits;     /* digits kept, base^ndigits fitting 63 bits */
+  std::vector<uint64_t> denom;  /* base^ndigits */
+  std::vector<uint64_t> place;  /* base^(ndigits-1-k) for digit k */
+  std::vector<uint32_t> digits;
+  std::vector<uint64_t> num;    /* coordinate is num/denom */
+  std::vector<size_t> permat;   /* start of the permutation of a dimension */
+  std::vector<uint32_t> perm;
+};
+
+inline uint32_t ReverseBits32(uint32_t x) {
+  x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+  x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+  x = ((x >> 4) & 0x0F0F0F0FU) | ((x & 0x0F0F0F0FU) << 4);
+  x = ((x >> 8) & 0x00FF00FFU) | ((x & 0x00FF00FFU) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+/* Owen scrambling of x: each bit flipped by a hash of the bits above it */
+inline uint32_t OwenScramble(uint32_t x, uint32_t seed) {
+  x = ReverseBits32(x);
+  x += seed;
+  x ^= x*0x6c50b47cU;
+  x ^= x*0xb82f1e52U;
+  x ^= x*0xc7afe638U;
+  x ^= x*0x8d22f6e6U;
+  return ReverseBits32(x);
+}
+
+void SobolInitDim(Qrng *q, int d) {
+  uint32_t *v = &q->v[d*SOBOL_BITS];
+  if (d == 0)
+  {
+    for (int k=0; k < SOBOL_BITS; k++) v[k] = 1U << (SOBOL_BITS-1-k);
+    return;
+  }
+  uint32_t poly = SobolPoly[d-1];
+  int s = 31-__builtin_clz(poly);
+  for (int k=0; k < s; k++) v[k] = (uint32_t) SobolInit[d-1][k] << (SOBOL_BITS-1-k);
+  for (int k=s; k < SOBOL_BITS; k++)
+  {
+    v[k] = v[k-s] ^ (v[k-s] >> s);
+    for (int j=1; j < s; j++)
+      if ((poly >> (s-j)) & 1) v[k] ^= v[k-j];
+  }
+}
+
+void HaltonInitDim(Qrng *q, int d, uint32_t p, uint64_t skip, uint64_t seed) {
+  q->base[d] = p;
+  int nd = 0;
+  uint64_t denom = 1;
+  while (denom <= (UINT64_C(1) << 63)/p)
+  {
+    denom *= p;
+    nd++;
+  }
+  q->ndigits[d] = nd;
+  q->denom[d] = denom;
+  q->permat[d] = q->perm.size();
+  for (uint32_t i=0; i < p; i++) q->perm.push_back(i);
+  uint32_t *perm = &q->perm[q->permat[d]];
+  if (seed)
+  {
+    uint64_t x = seed ^ (d * 0x9E3779B97F4A7C15ULL);
+    for (uint32_t i=p-1; i > 1; i--)
+      std::swap(perm[i],perm[1+SplitMix64(&x)%i]);
+  }
+  uint64_t place = denom;
+  q->num[d] = 0;
+  for (int k=0; k < nd; k++)
+  {
+    place /= p;
+    q->place[d*64+k] = place;
+    q->digits[d*64+k] = skip % p;
+    q->num[d] += perm[skip % p]*place;
+    skip /= p;
+  }
+}
+
+/* Sets up the sequence from point skip on, scrambled if seed is not 0 */
+void QrngInit(Qrng *q, int kind, int dim, uint64_t skip, uint64_t seed, const Options *opt) {
+  q->kind = kind;
+  q->dim = dim;
+  q->inverse = opt->inverse;
+  q->invp[0] = opt->invp[0];
+  q->invp[1] = opt->invp[1];
+  q->index = skip;
+  q->point.resize(dim);
+  q->pos = dim;
+  if (kind == QRNG_SOBOL)
+  {
+    q->v.resize(dim*SOBOL_BITS);
+    q->x.assign(dim,0);
+    q->seeds.assign(dim,0);
+    uint64_t gray = skip ^ (skip >> 1);
+    for (int d=0; d < dim; d++)
+    {
+      SobolInitDim(q,d);
+      for (int k=0; k < SOBOL_BITS; k++)
+        if ((gray >> k) & 1) q->x[d] ^= q->v[d*SOBOL_BITS+k];
+      if (seed)
+      {
+        uint64_t x = seed+d;
+        q->seeds[d] = (uint32_t) SplitMix64(&x);
+      }
+    }
+    return;
+  }
+  q->base.resize(dim);
+  q->ndigits.resize(dim);
+  q->denom.resize(dim);
+  q->place.resize(dim*64);
+  q->digits.resize(dim*64);
+  q->num.resize(dim);
+  q->permat.resize(dim);
+  uint32_t p = 1;
+  for (int d=0; d < dim; d++)
+  {
+    /* next prime, by trial division as there are few */
+    for (p++; ; p++)
+    {
+      uint32_t f = 2;
+      while (f*f <= p && p % f) f++;
+      if (f*f > p) break;
+    }
+    HaltonInitDim(q,d,p,skip,seed);
+  }
+}
+
+/* Unit coordinate c of a cell of width w, mapped by the inverse if any */
+inline double QrngMap(const Qrng *q, double c, double w) {
+  if (q->inverse == OPT_NORM) return q->invp[0] + q->invp[1]*NormalQuantile(c+0.5*w);
+  if (q->inverse == OPT_EXP) return -std::log1p(-(c+0.5*w))/q->invp[0];
+  return c;
+}
+
+/* Makes the point at index into q->point and steps to the next */
+void QrngNext(Qrng *q) {
+  if (q->kind == QRNG_SOBOL)
+  {
+    int c = __builtin_ctzll(~q->index);
+    for (int d=0; d < q->dim; d++)
+    {
+      uint32_t x = q->x[d];
+      if (q->seeds[d]) x = OwenScramble(x,q->seeds[d]);
+      q->point[d] = QrngMap(q,x*0x1.0p-32,0x1.0p-32);
+      if (c < SOBOL_BITS) q->x[d] ^= q->v[d*SOBOL_BITS+c];
+    }
+  }
+  else
+  {
+    for (int d=0; d < q->dim; d++)
+    {
+      double denom = (double) q->denom[d];
+      q->point[d] = QrngMap(q,q->num[d]/denom,1/denom);
+      uint32_t p = q->base[d];
+      const uint32_t *perm = &q->perm[q->permat[d]];
+      uint32_t *digits = &q->digits[d*64];
+      const uint64_t *place = &q->place[d*64];
+      for (int k=0; k < q->ndigits[d]; k++)
+      {
+        uint32_t a = digits[k];
+        uint32_t b = a+1 < p ? a+1 : 0;
+        digits[k] = b;
+        q->num[d] += perm[b]*place[k] - perm[a]*place[k];
+        if (b) break;
+      }
+    }
+  }
+  q->index++;
+  q->pos = 0;
+}
+
+/* Coordinates of the points one after the other, n at a time */
+void QrngFill(Qrng *q, double *out, size_t n) {
+  while (n > 0)
+  {
+    if (q->pos == (size_t) q->dim) QrngNext(q);
+    size_t m = q->dim-q->pos < n ? q->dim-q->pos : n;
+    memcpy(out,&q->point[q->pos],m*sizeof(double));
+    q->pos += m;
+    out += m;
+    n -= m;
+  }
+}
+
+/* Parses DIM and the optional SKIP at argv[at], for count points, and sets
+ * up the sequence. Replies with an error and returns NULL if they are not
+ * valid. The seed of SCRAMBLE is drawn if not given, into opt. */
+std::shared_ptr<Qrng> QrngFromArgs(RedisModuleCtx *ctx, int kind, RedisModuleString **argv, int argc, int at, long long count, Options *opt) {
+  long long dim, skip = 0;
+  int maxdim = kind == QRNG_SOBOL ? SOBOL_MAX_DIM : HALTON_MAX_DIM;
+  if (RedisModule_StringToLongLong(argv[at],&dim) != REDISMODULE_OK || dim < 1 || dim > maxdim)
+  {
+    RedisModule_ReplyWithError(ctx,"ERR invalid dimension");
+    return NULL;
+  }
+  if (at+1 < argc &&
+      (RedisModule_StringToLongLong(argv[at+1],&skip) != REDISMODULE_OK || skip < 0))
+  {
+    RedisModule_ReplyWithError(ctx,"ERR invalid skip");
+    return NULL;
+  }
+  if (kind == QRNG_SOBOL && (uint64_t) skip + (uint64_t) count > (UINT64_C(1) << SOBOL_BITS))
+  {
+    RedisModule_ReplyWithError(ctx,"ERR past the last Sobol point");
+    return NULL;
+  }
+  if (opt->scramble && !opt->hasseed)
+  {
+    opt->seed = (*opt->engine)();
+    opt->hasseed = 1;
+  }
+  std::shared_ptr<Qrng> q = std::make_shared<Qrng>();
+  QrngInit(q.get(),kind,dim,skip,opt->scramble ? opt->seed|1 : 0,opt);
+  return q;
+}
+
+/* RANDOM.SOBOL / RANDOM.HALTON DIM [SKIP] [COUNT n] [SCRAMBLE] [SEED s]
+ *   [NORM mean sd | EXP lambda] [ENGINE name]
+ * A point, or an array of COUNT points, each an array of DIM coordinates */
+int QrngReply(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int kind) {
+  Options opt;
+  if (argc < 2) return RedisModule_WrongArity(ctx);
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_COUNT | OPT_SCRAMBLE | OPT_SEED | OPT_NORM | OPT_EXP | OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc > 3) return RedisModule_WrongArity(ctx);
+  long long count = opt.count < 0 ? 1 : opt.count;
+  std::shared_ptr<Qrng> q = QrngFromArgs(ctx,kind,argv,argc,1,count,&opt);
+  if (!q) return REDISMODULE_OK;
+
+  int single = opt.count < 0;
+  curStats->samples += count*q->dim;
+  auto reply = [=](RedisModuleCtx *ctx, Engine &) {
+    if (!single) RedisModule_ReplyWithArray(ctx,count);
+    for (long long i=0; i < count; i++)
+    {
+      QrngNext(q.get());
+      RedisModule_ReplyWithArray(ctx,q->dim);
+      for (double c : q->point) RedisModule_ReplyWithDouble(ctx,c);
+    }
+  };
+  if (!RunAsync(ctx,count*q->dim,opt.engine,reply)) reply(ctx,*opt.engine);
+  return REDISMODULE_OK;
+}
+
+int RandomSobol_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  return QrngReply(ctx,argv,argc,QRNG_SOBOL);
+}
+
+int RandomHalton_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  return QrngReply(ctx,argv,argc,QRNG_HALTON);
+}
+
+/* RANDOM.LSOBOL / RANDOM.LHALTON KEY COUNT DIM [SKIP] [SCRAMBLE] [SEED s]
+ *   [NORM mean sd | EXP lambda] [PACKED] [ENGINE name]
+ * Pushes the coordinates of COUNT points, one point after the other */
+int QrngStore(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int kind) {
+  Options opt;
+  int nargs = argc;
+  if (argc < 4) return RedisModule_WrongArity(ctx);
+  if (ParseOptions(ctx, argv, &argc, 4, OPT_PACKED | OPT_ENCODING | OPT_ENGINE | OPT_LIVEHIST | OPT_SKETCH | OPT_SEED | OPT_TAIL |
+                   OPT_SCRAMBLE | OPT_NORM | OPT_EXP, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc > 5) return RedisModule_WrongArity(ctx);
+  long long count;
+  if (RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK || count < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  std::shared_ptr<Qrng> q = QrngFromArgs(ctx,kind,argv,argc,3,count,&opt);
+  if (!q) return REDISMODULE_OK;
+  if (count > INT64_MAX/q->dim)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+
+  SampleSink sink;
+  if (SampleSinkOpen(ctx, argv[1], &opt, &sink) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  if (!opt.hasseed)
+  {
+    opt.seed = (*opt.engine)();
+    opt.hasseed = 1;
+  }
+  SampleSinkReserve(&sink, count*q->dim);
+  if (opt.livecells || opt.alpha) SampleSinkLive(&sink, argv[1], &opt);
+  SampleSinkRun(&sink, count*q->dim, &opt, [=](Engine &, double *buf, size_t n) {
+    QrngFill(q.get(),buf,n);
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+int RandomLSobol_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  return QrngStore(ctx,argv,argc,QRNG_SOBOL);
+}
+
+int RandomLHalton_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  return QrngStore(ctx,argv,argc,QRNG_HALTON);
+}
+
+/* Parses a sample stored as text in place, accepting what
+ * RedisModule_StringToDouble accepts */
+inline int ParseSample(const char *p, size_t len, double *d) {
+  const char *end = p+len;
+  if (p < end && *p == '+') p++;
+  std::from_chars_result r = std::from_chars(p,end,*d);
+  if (r.ec != std::errc() || r.ptr != end || std::isnan(*d))
+    return REDISMODULE_ERR;
+  return REDISMODULE_OK;
+}
+
+/* Elements fetched per LRANGE when scanning a list */
+#define SCAN_CHUNK 65536
+
+/* Returns the sample set held by key, or NULL */
+SampleSet *GetSampleSet(RedisModuleKey *key) {
+  if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_MODULE ||
+      RedisModule_ModuleTypeGetType(key) != SampleSetType)
+    return NULL;
+  return (SampleSet *) RedisModule_ModuleTypeGetValue(key);
+}
+
+/* Virtual keys, defined with the named samplers they draw from. Their
+ * samples are made VIRTUAL_BLOCK at a time. */
+#define VIRTUAL_BLOCK 256
+struct Recipe;
+Recipe *GetRecipe(RedisModuleKey *key);
+long long RecipeLength(const Recipe *r);
+void RecipeFill(const Recipe *r, long long start, double *out, size_t n);
+
+/* Calls f(v,n) over the samples of a list, sample set or virtual key, a
+ * chunk at a time and reading each sample once. List elements are fetched
+ * SCAN_CHUNK at a time and parsed straight from the call reply, virtual
+ * samples are made ASYNC_CHUNK at a time. Returns NULL, or an error
+ * message if the key is missing, of another type or holds a bad value. */
+template <class F>
+const char *ScanKey(RedisModuleCtx *ctx, RedisModuleString *keyname, F f) {
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ);
+  int type = RedisModule_KeyType(key);
+  SampleSet *ss = GetSampleSet(key);
+  Recipe *r = GetRecipe(key);
+  RedisModule_CloseKey(key);
+  if (ss)
+  {
+    SampleSetScan(ss,f);
+    return NULL;
+  }
+  if (r)
+  {
+    std::vector<double> buf(ASYNC_CHUNK);
+    long long len = RecipeLength(r);
+    for (long long start=0; start < len; start += ASYNC_CHUNK)
+    {
+      size_t n = len-start < ASYNC_CHUNK ? len-start : ASYNC_CHUNK;
+      RecipeFill(r,start,buf.data(),n);
+      f((const double *) buf.data(),n);
+    }
+    return NULL;
+  }
+  if (type == REDISMODULE_KEYTYPE_EMPTY) return "ERR no such key";
+  if (type != REDISMODULE_KEYTYPE_LIST) return REDISMODULE_ERRORMSG_WRONGTYPE;
+
+  std::vector<double> buf;
+  for (long long start=0; ; start += SCAN_CHUNK)
+  {
+    RedisModuleCallReply *reply = RedisModule_Call(ctx,"LRANGE","sll",keyname,start,start+SCAN_CHUNK-1);
+    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY)
+    {
+      RedisModule_FreeCallReply(reply);
+      return "ERR error in key";
+    }
+    size_t n = RedisModule_CallReplyLength(reply);
+    buf.resize(n);
+    for (size_t i=0; i < n; i++)
+    {
+      size_t len;
+      const char *p = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply,i),&len);
+      if (ParseSample(p,len,&buf[i]) != REDISMODULE_OK)
+      {
+        RedisModule_FreeCallReply(reply);
+        return "ERR bad list value";
+      }
+    }
+    RedisModule_FreeCallReply(reply);
+    if (n) f((const double *) buf.data(),n);
+    if (n < SCAN_CHUNK) return NULL;
+  }
+}
+
+/* ScanKey, counted in the scan stats of the command */
+template <class F>
+const char *ScanSamples(RedisModuleCtx *ctx, RedisModuleString *keyname, F f) {
+  uint64_t t0 = StatsClock();
+  long long scanned = 0;
+  const char *err = ScanKey(ctx, keyname, [&](const double *v, size_t n) {
+    f(v,n);
+    scanned += n;
+  });
+  curStats->scanned += scanned;
+  curStats->scanticks += StatsClock()-t0;
+  return err;
+}
+
+/* Brings a live histogram up to date with one pass over its key */
+const char *LiveStatsRescan(RedisModuleCtx *ctx, RedisModuleString *keyname, LiveStats *ls) {
+  LiveStatsReset(ls);
+  const char *err = ScanSamples(ctx, keyname, [&](const double *v, size_t n) {
+    LiveStatsAdd(ls,v,n);
+    ls->len += n;
+  });
+  if (err) ls->dirty = 1;
+  return err;
+}
+
+/* The live histogram of a key, rescanned if dirty or if the key length
+ * shows changes that were missed, such as a FLUSHALL. NULL if the key has
+ * none, or on error with err set. */
+LiveStats *LiveStatsGet(RedisModuleCtx *ctx, RedisModuleString *keyname, const char **err) {
+  *err = NULL;
+  LiveStats *ls = LiveStatsFind(ctx,keyname);
+  if (ls == NULL) return NULL;
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ);
+  int type = RedisModule_KeyType(key);
+  SampleSet *ss = GetSampleSet(key);
+  size_t len = ss ? ss->len : RedisModule_ValueLength(key);
+  RedisModule_CloseKey(key);
+  if (!ss && type != REDISMODULE_KEYTYPE_LIST)
+  {
+    liveStats.erase(LiveStatsId(RedisModule_GetSelectedDb(ctx),keyname));
+    return NULL;
+  }
+  if (ls->dirty || ls->len != len)
+    *err = LiveStatsRescan(ctx,keyname,ls);
+  return *err ? NULL : ls;
+}
+
+/* Live histogram of a key being renamed, between its two events */
+LiveStats renamedStats;
+int haveRenamedStats;
+
+/* Keyspace notifications, to follow changes made by other commands */
+int LiveStatsNotify(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *keyname) {
+  if (liveStats.empty() && !haveRenamedStats) return REDISMODULE_OK;
+  std::string id = LiveStatsId(RedisModule_GetSelectedDb(ctx),keyname);
+
+  if (!strcmp(event,"rename_from"))
+  {
+    auto it = liveStats.find(id);
+    haveRenamedStats = it != liveStats.end();
+    if (haveRenamedStats)
+    {
+      renamedStats = std::move(it->second);
+      liveStats.erase(it);
+    }
+    return REDISMODULE_OK;
+  }
+  if (!strcmp(event,"rename_to"))
+  {
+    liveStats.erase(id);
+    if (haveRenamedStats) liveStats[id] = std::move(renamedStats);
+    haveRenamedStats = 0;
+    return REDISMODULE_OK;
+  }
+
+  auto it = liveStats.find(id);
+  if (it == liveStats.end()) return REDISMODULE_OK;
+  LiveStats &ls = it->second;
+
+  int lpush = !strcmp(event,"lpush");
+  if (lpush || !strcmp(event,"rpush"))
+  {
+    if (ls.dirty) return REDISMODULE_OK;
+    /* The new elements are at the end they were pushed to */
+    RedisModuleCallReply *reply = RedisModule_Call(ctx,"LLEN","s",keyname);
+    long long len = RedisModule_CallReplyInteger(reply);
+    RedisModule_FreeCallReply(reply);
+    long long added = len - (long long) ls.len;
+    if (added <= 0)
+    {
+      ls.dirty = 1;
+      return REDISMODULE_OK;
+    }
+    if (lpush)
+      reply = RedisModule_Call(ctx,"LRANGE","sll",keyname,0LL,added-1);
+    else
+      reply = RedisModule_Call(ctx,"LRANGE","sll",keyname,-added,-1LL);
+    size_t n = RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ARRAY ?
+      RedisModule_CallReplyLength(reply) : 0;
+    for (size_t i=0; i < n && !ls.dirty; i++)
+    {
+      size_t slen;
+      double d;
+      const char *p = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply,i),&slen);
+      if (ParseSample(p,slen,&d) == REDISMODULE_OK)
+        LiveStatsAdd(&ls,&d,1);
+      else
+        ls.dirty = 1;
+    }
+    RedisModule_FreeCallReply(reply);
+    if (n != (size_t) added) ls.dirty = 1;
+    ls.len = len;
+  }
+  else if (!strcmp(event,"del") || !strcmp(event,"expired") ||
+           !strcmp(event,"evicted") || !strcmp(event,"restore") ||
+           !strcmp(event,"sortstore"))
+    liveStats.erase(it);
+  else if (type & REDISMODULE_NOTIFY_LIST)
+    ls.dirty = 1;   /* pops, LSET, LREM, LTRIM, LINSERT */
+  return REDISMODULE_OK;
+}
+
+/* Replies with histogram counts, or with '*' bars at most col wide */
+int HistReply(RedisModuleCtx *ctx, long long *hist, long long slots, long long col) {
+  RedisModule_ReplyWithArray(ctx,slots);
+  if (col==0)
+  {
+    for (auto i=0; i < slots; i++)
+      RedisModule_ReplyWithLongLong(ctx,hist[i]);
+  }
+  else
+  {
+    std::string s(col,'*');
+    double hmax=hist[0];
+    for (auto i=0; i < slots; i++)
+      if (hmax < hist[i]) 
+        hmax = hist[i];
+    for (auto i=0; i < slots; i++)
+      RedisModule_ReplyWithStringBuffer(ctx,s.data(),hmax > 0 ? std::floor(((double) hist[i])/hmax*col) : 0);
+  }
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.HIST KEY [CELLS=10] [COLUMNS] [MIN min] [MAX max]
+ * Without both MIN and MAX the range of the samples is used, which takes
+ * a first pass over them: lists are read twice and virtual keys made
+ * twice, a chunk at a time. With both, samples outside the bounds are
+ * left out and a single streaming pass is made. Keys with a live
+ * histogram reply from it, unless other cells are asked for. */
+int RandomHist_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_MIN | OPT_MAX, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 2 || argc > 4) return RedisModule_WrongArity(ctx);
+
+  long long slots=10;
+  long long col=0;
+
+  if (argc >= 3) 
+  {
+    if ((RedisModule_StringToLongLong(argv[2],&slots) != REDISMODULE_OK) ||
+        (slots < 1) || (slots > HIST_MAX_CELLS))
+      return RedisModule_ReplyWithError(ctx,"ERR invalid hist size");
+  }
+  if (argc == 4) 
+  {
+    if ((RedisModule_StringToLongLong(argv[3],&col) != REDISMODULE_OK) ||
+        (col < 0) || (col > HIST_MAX_CELLS))
+      return RedisModule_ReplyWithError(ctx,"ERR invalid columns size");
+  }
+
+  /* A live histogram answers if the request does not ask for other cells */
+  LiveStats *ls = LiveStatsFind(ctx,argv[1]);
+  const char *err;
+  if (ls && ls->cells && (argc < 3 || slots == ls->cells) &&
+      (!opt.hasmin || opt.min == ls->min) && (!opt.hasmax || opt.max == ls->max))
+  {
+    ls = LiveStatsGet(ctx,argv[1],&err);
+    if (err) return RedisModule_ReplyWithError(ctx,err);
+    if (ls) return HistReply(ctx,ls->bins.data(),ls->cells,col);
+  }
+
+  std::vector<long long> hist(slots,0);
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+  SampleSet *ss = GetSampleSet(key);
+  RedisModule_CloseKey(key);
+  if (ss)
+  {
+    /* Sample sets are read where they are, in their own encoding */
+    uint64_t t0 = StatsClock();
+    double min = opt.min, max = opt.max;
+    if (!(opt.hasmin && opt.hasmax) && ss->len > 0)
+    {
+      double lo, hi;
+      SampleSetRange(ss,&lo,&hi);
+      if (!opt.hasmin) min = lo;
+      if (!opt.hasmax) max = hi;
+    }
+    if ((opt.hasmin && opt.hasmax) || ss->len > 0)
+    {
+      if (min > max)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+      SampleSetHist(ss,hist.data(),slots,min,max);
+    }
+    curStats->scanned += ss->len;
+    curStats->scanticks += StatsClock()-t0;
+    err = NULL;
+  }
+  else if (opt.hasmin && opt.hasmax)
+  {
+    if (opt.min > opt.max)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+    err = ScanSamples(ctx, argv[1], [&](const double *v, size_t n) {
+      HistAdd(hist.data(),slots,opt.min,opt.max,v,n);
+    });
+  }
+  else
+  {
+    /* Lists are read twice, for their range and for the cells, a chunk at
+     * a time as the single pass does, and virtual keys are made twice */
+    double min=INFINITY, max=-INFINITY;
+    size_t count = 0;
+    err = ScanSamples(ctx, argv[1], [&](const double *chunk, size_t n) {
+      for (size_t i=0; i < n; i++)
+      {
+        if (chunk[i] < min) min=chunk[i];
+        if (chunk[i] > max) max=chunk[i];
+      }
+      count += n;
+    });
+    if (opt.hasmin) min = opt.min;
+    if (opt.hasmax) max = opt.max;
+    if (err == NULL && count > 0)
+    {
+      if (min > max)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+      err = ScanSamples(ctx, argv[1], [&](const double *chunk, size_t n) {
+        HistAdd(hist.data(),slots,min,max,chunk,n);
+      });
+    }
+  }
+  if (err) return RedisModule_ReplyWithError(ctx,err);
+
+  return HistReply(ctx,hist.data(),slots,col);
+}
+
+/* RANDOM.SLOAD KEY BLOB [ENCODING e] [SCALE s]
+ * Appends little endian samples, doubles unless another encoding is
+ * given, to a packed sample set, as emitted by AOF rewrites. A new set
+ * takes the encoding of the blob, and an empty blob makes an empty set. */
+int RandomSLoad_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_ENCODING, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
   if (argc != 3) return RedisModule_WrongArity(ctx);
-  long long start, end;
-  if (
-      (RedisModule_StringToLongLong(argv[1],&start) != REDISMODULE_OK) ||
-      (RedisModule_StringToLongLong(argv[2],&end) != REDISMODULE_OK) ||
-      (start > end) 
-      ) 
+  if (opt.encoding == SAMPLE_TEXT)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid sample blob");
+  size_t blen, width = SampleWidth(opt.encoding);
+  const char *blob = RedisModule_StringPtrLen(argv[2],&blen);
+  if (blen % width)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid sample blob");
+
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  SampleSet *ss;
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY)
+  {
+    ss = SampleSetCreate(opt.encoding,opt.scale);
+    RedisModule_ModuleTypeSetValue(key,SampleSetType,ss);
+  }
+  else if (RedisModule_ModuleTypeGetType(key) == SampleSetType)
+    ss = (SampleSet *) RedisModule_ModuleTypeGetValue(key);
+  else
+  {
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+
+  size_t n = blen/width, start = ss->len;
+  SampleSetReserve(ss,ss->len+n);
+  SampleSetUnpack(ss,blob,n,opt.encoding,opt.encoding >= SAMPLE_I16 ? opt.scale : 1);
+  LiveStats *ls = LiveStatsFind(ctx,argv[1]);
+  if (ls && !ls->dirty)
+  {
+    double buf[SAMPLESET_CHUNK];
+    for (size_t i=start; i < ss->len; i += SAMPLESET_CHUNK)
+    {
+      size_t m = std::min((size_t) SAMPLESET_CHUNK, ss->len-i);
+      SampleSetRead(ss,i,buf,m);
+      LiveStatsAdd(ls,buf,m);
+    }
+    ls->len += n;
+  }
+  curStats->bytes += blen;
+  RedisModule_CloseKey(key);
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx,ss->len);
+}
+
+/* RANDOM.RANGE KEY START STOP
+ * Samples of a packed sample set or virtual key, indexed like LRANGE */
+int RandomRange_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 4) return RedisModule_WrongArity(ctx);
+  long long start, stop;
+  if ((RedisModule_StringToLongLong(argv[2],&start) != REDISMODULE_OK) ||
+      (RedisModule_StringToLongLong(argv[3],&stop) != REDISMODULE_OK))
     return RedisModule_ReplyWithError(ctx,"ERR invalid range");
 
-  std::uniform_int_distribution<long long> rdunif(start,end);
-  RedisModule_ReplyWithLongLong(ctx,rdunif(gen));
-  return REDISMODULE_OK;
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY)
+  {
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithArray(ctx,0);
+  }
+  SampleSet *ss = GetSampleSet(key);
+  Recipe *r = GetRecipe(key);
+  if (!ss && !r)
+  {
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+  long long len = ss ? ss->len : RecipeLength(r);
+  if (start < 0) start += len;
+  if (stop < 0) stop += len;
+  if (start < 0) start = 0;
+  if (stop >= len) stop = len-1;
+  if (start > stop)
+  {
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithArray(ctx,0);
+  }
+  RedisModule_ReplyWithArray(ctx,stop-start+1);
+  if (ss)
+  {
+    for (long long i=start; i <= stop; i++)
+      RedisModule_ReplyWithDouble(ctx,SampleSetGet(ss,i));
+  }
+  else
+  {
+    double buf[SAMPLE_BATCH];
+    for (long long i=start; i <= stop; i += SAMPLE_BATCH)
+    {
+      size_t n = stop-i+1 < SAMPLE_BATCH ? stop-i+1 : SAMPLE_BATCH;
+      RecipeFill(r,i,buf,n);
+      for (size_t j=0; j < n; j++)
+        RedisModule_ReplyWithDouble(ctx,buf[j]);
+    }
+    curStats->samples += stop-start+1;
+  }
+  RedisModule_CloseKey(key);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.LIVEHIST KEY
+ * Cells, bounds and running totals of the live histogram of a key */
+int RandomLiveHist_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 2) return RedisModule_WrongArity(ctx);
+  const char *err;
+  LiveStats *ls = LiveStatsGet(ctx,argv[1],&err);
+  if (err) return RedisModule_ReplyWithError(ctx,err);
+  if (ls == NULL || ls->cells == 0) return RedisModule_ReplyWithNull(ctx);
+
+  RedisModule_ReplyWithArray(ctx,16);
+  RedisModule_ReplyWithSimpleString(ctx,"cells");
+  RedisModule_ReplyWithLongLong(ctx,ls->cells);
+  RedisModule_ReplyWithSimpleString(ctx,"min");
+  RedisModule_ReplyWithDouble(ctx,ls->min);
+  RedisModule_ReplyWithSimpleString(ctx,"max");
+  RedisModule_ReplyWithDouble(ctx,ls->max);
+  RedisModule_ReplyWithSimpleString(ctx,"count");
+  RedisModule_ReplyWithLongLong(ctx,ls->count);
+  RedisModule_ReplyWithSimpleString(ctx,"lowest");
+  RedisModule_ReplyWithDouble(ctx,ls->lo);
+  RedisModule_ReplyWithSimpleString(ctx,"highest");
+  RedisModule_ReplyWithDouble(ctx,ls->hi);
+  RedisModule_ReplyWithSimpleString(ctx,"underflow");
+  RedisModule_ReplyWithLongLong(ctx,ls->under);
+  RedisModule_ReplyWithSimpleString(ctx,"overflow");
+  RedisModule_ReplyWithLongLong(ctx,ls->over);
+  return REDISMODULE_OK;
+}
+
+/* Returns the sketch held by key, or NULL */
+Sketch *GetSketch(RedisModuleKey *key) {
+  if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_MODULE ||
+      RedisModule_ModuleTypeGetType(key) != SketchType)
+    return NULL;
+  return (Sketch *) RedisModule_ModuleTypeGetValue(key);
+}
+
+/* Calls f(sk) with the sketch of a key: the key itself if it is a sketch,
+ * else the live sketch of its samples, else one made with a scan of them.
+ * Returns NULL or an error message. */
+template <class F>
+const char *WithSketch(RedisModuleCtx *ctx, RedisModuleString *keyname, F f) {
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ);
+  Sketch *sk = GetSketch(key);
+  RedisModule_CloseKey(key);
+  if (sk)
+  {
+    f(sk);
+    return NULL;
+  }
+  const char *err;
+  LiveStats *ls = LiveStatsFind(ctx,keyname);
+  if (ls && ls->sketch.alpha)
+  {
+    ls = LiveStatsGet(ctx,keyname,&err);
+    if (err) return err;
+    if (ls)
+    {
+      f(&ls->sketch);
+      return NULL;
+    }
+  }
+  Sketch scan;
+  SketchInit(&scan,SKETCH_ALPHA);
+  err = ScanSamples(ctx, keyname, [&](const double *v, size_t n) {
+    SketchAdd(&scan,v,n);
+  });
+  if (err == NULL) f(&scan);
+  return err;
+}
+
+/* Opens a sketch key for writing, creating it with alpha if empty. NULL
+ * after replying with an error if it holds something else, or a sketch of
+ * another alpha when one is given. */
+Sketch *OpenSketch(RedisModuleCtx *ctx, RedisModuleKey *key, double alpha, int strict) {
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY)
+  {
+    Sketch *sk = SketchCreate(alpha);
+    RedisModule_ModuleTypeSetValue(key,SketchType,sk);
+    return sk;
+  }
+  Sketch *sk = GetSketch(key);
+  if (sk == NULL)
+    RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  else if (strict && sk->alpha != alpha)
+  {
+    RedisModule_ReplyWithError(ctx,"ERR sketch accuracy differs");
+    sk = NULL;
+  }
+  return sk;
+}
+
+/* RANDOM.QUANTILE KEY P [P ...]
+ * Quantiles of a sketch, or of the samples of a list or sample set, from
+ * their live sketch or else a sketch made with one pass. Null when there
+ * are no samples. */
+int RandomQuantile_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+  std::vector<double> q(argc-2);
+  for (int i=2; i < argc; i++)
+  {
+    if ((RedisModule_StringToDouble(argv[i],&q[i-2]) != REDISMODULE_OK) ||
+        !(q[i-2] >= 0 && q[i-2] <= 1))
+      return RedisModule_ReplyWithError(ctx,"ERR invalid quantile");
+  }
+  const char *err = WithSketch(ctx, argv[1], [&](const Sketch *sk) {
+    RedisModule_ReplyWithArray(ctx,q.size());
+    for (double p : q)
+    {
+      if (sk->count == 0)
+        RedisModule_ReplyWithNull(ctx);
+      else
+        RedisModule_ReplyWithDouble(ctx,SketchQuantile(sk,p));
+    }
+  });
+  if (err) return RedisModule_ReplyWithError(ctx,err);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.QADD KEY VALUE [VALUE ...] [ALPHA alpha]
+ * Adds values to a sketch, created with ALPHA (0.01 by default) if the
+ * key is empty. Replies with the sketch count. */
+int RandomQAdd_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_ALPHA, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+  std::vector<double> v(argc-2);
+  for (int i=2; i < argc; i++)
+  {
+    if ((RedisModule_StringToDouble(argv[i],&v[i-2]) != REDISMODULE_OK) ||
+        !std::isfinite(v[i-2]))
+      return RedisModule_ReplyWithError(ctx,"ERR invalid value");
+  }
+
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  Sketch *sk = OpenSketch(ctx,key,opt.alpha ? opt.alpha : SKETCH_ALPHA,opt.alpha != 0);
+  if (sk == NULL)
+  {
+    RedisModule_CloseKey(key);
+    return REDISMODULE_OK;
+  }
+  SketchAdd(sk,v.data(),v.size());
+  RedisModule_CloseKey(key);
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx,sk->count);
+}
+
+/* RANDOM.QBUILD DEST SRC [ALPHA alpha]
+ * Stores at DEST a sketch of the samples of SRC, a list or sample set,
+ * replacing DEST. Replies with the sketch count. */
+int RandomQBuild_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_ALPHA, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 3) return RedisModule_WrongArity(ctx);
+
+  Sketch *sk = SketchCreate(opt.alpha ? opt.alpha : SKETCH_ALPHA);
+  const char *err = ScanSamples(ctx, argv[2], [&](const double *v, size_t n) {
+    SketchAdd(sk,v,n);
+  });
+  if (err)
+  {
+    SketchFree(sk);
+    return RedisModule_ReplyWithError(ctx,err);
+  }
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  RedisModule_ModuleTypeSetValue(key,SketchType,sk);
+  RedisModule_CloseKey(key);
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx,sk->count);
+}
+
+/* RANDOM.QEXPORT KEY
+ * The sketch of a key as a binary blob, for RANDOM.QMERGE on any node */
+int RandomQExport_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 2) return RedisModule_WrongArity(ctx);
+  const char *err = WithSketch(ctx, argv[1], [&](const Sketch *sk) {
+    std::string blob = SketchEncode(sk);
+    RedisModule_ReplyWithStringBuffer(ctx,blob.data(),blob.size());
+  });
+  if (err) return RedisModule_ReplyWithError(ctx,err);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.QMERGE DEST BLOB [BLOB ...]
+ * Merges exported sketches into the sketch at DEST, created with the
+ * accuracy of the first blob if empty. All must share that accuracy.
+ * Replies with the sketch count. */
+int RandomQMerge_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+  std::vector<Sketch *> src;
+  const char *err = NULL;
+  for (int i=2; i < argc && !err; i++)
+  {
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(argv[i],&len);
+    Sketch *sk = SketchDecode(p,len);
+    if (sk == NULL)
+      err = "ERR invalid sketch blob";
+    else
+    {
+      src.push_back(sk);
+      if (sk->alpha != src[0]->alpha) err = "ERR sketch accuracy differs";
+    }
+  }
+
+  Sketch *dst = NULL;
+  RedisModuleKey *key = NULL;
+  if (err)
+    RedisModule_ReplyWithError(ctx,err);
+  else
+  {
+    key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    dst = OpenSketch(ctx,key,src[0]->alpha,1);
+  }
+  if (dst)
+  {
+    for (Sketch *sk : src)
+      SketchMerge(dst,sk);
+    RedisModule_ReplicateVerbatim(ctx);
+    RedisModule_ReplyWithLongLong(ctx,dst->count);
+  }
+  if (key) RedisModule_CloseKey(key);
+  for (Sketch *sk : src)
+    SketchFree(sk);
+  return REDISMODULE_OK;
+}
+
+/* Picks from keys
+ * RANDOM.PICK takes K random elements of a key without reading all of it
+ * where the type allows. Lists and sorted sets are read by index: the
+ * positions are drawn first, with Floyd's algorithm when they must
+ * differ, and fetched in order of position with one LRANGE or ZRANGE per
+ * run of close positions, so only about K elements are touched. Sample
+ * sets and virtual keys are read by index too. Sets are sampled by
+ * SRANDMEMBER, and hashes, which have no index, by walking HSCAN up to
+ * the last position drawn, without copying the key. */
+
+/* Positions further apart than this are fetched by separate calls */
+#define PICK_GAP 64
+
+/* Elements at positions pos of a list or sorted set, read with cmd */
+const char *PickByIndex(RedisModuleCtx *ctx, RedisModuleString *keyname, const char *cmd,
+                        const std::vector<uint64_t> &pos, std::vector<std::string> &out) {
+  std::vector<std::pair<uint64_t,size_t>> order(pos.size());
+  for (size_t i=0; i < pos.size(); i++) order[i] = {pos[i],i};
+  std::sort(order.begin(),order.end());
+  out.resize(pos.size());
+  for (size_t i=0, j; i < order.size(); i=j)
+  {
+    for (j=i+1; j < order.size() && order[j].first-order[j-1].first <= PICK_GAP &&
+         order[j].first-order[i].first < SCAN_CHUNK; j++);
+    long long first = order[i].first, last = order[j-1].first;
+    RedisModuleCallReply *reply = RedisModule_Call(ctx,cmd,"sll",keyname,first,last);
+    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY ||
+        RedisModule_CallReplyLength(reply) != (size_t) (last-first+1))
+    {
+      RedisModule_FreeCallReply(reply);
+      return "ERR error in key";
+    }
+    for (size_t t=i; t < j; t++)
+    {
+      size_t len;
+      RedisModuleCallReply *e = RedisModule_CallReplyArrayElement(reply,order[t].first-first);
+      const char *p = RedisModule_CallReplyStringPtr(e,&len);
+      out[order[t].second].assign(p,len);
+    }
+    RedisModule_FreeCallReply(reply);
+  }
+  return NULL;
+}
+
+/* Fields at positions pos of a hash, in the order HSCAN goes over them.
+ * HSCAN may give a field again, while the hash is being rehashed, so the
+ * fields counted are kept to leave repeats out. */
+const char *PickByScan(RedisModuleCtx *ctx, RedisModuleString *keyname,
+                       const std::vector<uint64_t> &pos, std::vector<std::string> &out) {
+  std::vector<std::pair<uint64_t,size_t>> order(pos.size());
+  for (size_t i=0; i < pos.size(); i++) order[i] = {pos[i],i};
+  std::sort(order.begin(),order.end());
+  out.resize(pos.size());
+  size_t next = 0;
+  uint64_t seen = 0;
+  std::unordered_set<std::string> counted;
+  std::string cursor = "0";
+  do
+  {
+    RedisModuleCallReply *reply = RedisModule_Call(ctx,"HSCAN","sccl",keyname,cursor.c_str(),"COUNT",1000LL);
+    if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY ||
+        RedisModule_CallReplyLength(reply) != 2)
+    {
+      RedisModule_FreeCallReply(reply);
+      return "ERR error in key";
+    }
+    size_t len;
+    const char *p = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply,0),&len);
+    cursor.assign(p,len);
+    RedisModuleCallReply *fields = RedisModule_CallReplyArrayElement(reply,1);
+    size_t n = RedisModule_CallReplyLength(fields);
+    for (size_t i=0; i < n && next < order.size(); i += 2)
+    {
+      p = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(fields,i),&len);
+      if (!counted.emplace(p,len).second) continue;
+      for (; next < order.size() && order[next].first == seen; next++)
+        out[order[next].second].assign(p,len);
+      seen++;
+    }
+    RedisModule_FreeCallReply(reply);
+  } while (next < order.size() && cursor != "0");
+  if (next < order.size()) return "ERR error in key";
+  return NULL;
+}
+
+/* K members of a set by SRANDMEMBER, shuffled, as it gives them in the
+ * order of the set when K is close to its size */
+const char *PickFromSet(RedisModuleCtx *ctx, RedisModuleString *keyname, long long k, int repl,
+                        Engine &eng, std::vector<std::string> &out) {
+  RedisModuleCallReply *reply = RedisModule_Call(ctx,"SRANDMEMBER","sl",keyname,repl ? -k : k);
+  if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY)
+  {
+    RedisModule_FreeCallReply(reply);
+    return "ERR error in key";
+  }
+  size_t n = RedisModule_CallReplyLength(reply);
+  out.resize(n);
+  for (size_t i=0; i < n; i++)
+  {
+    size_t len;
+    const char *p = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply,i),&len);
+    out[i].assign(p,len);
+  }
+  RedisModule_FreeCallReply(reply);
+  for (size_t i=n; i > 1; i--)
+    std::swap(out[i-1],out[BoundedWord(eng,eng(),i)]);
+  return NULL;
+}
+
+/* RANDOM.PICK KEY K [WITHREPLACEMENT] [STORE dest] [ENGINE name] [SEED s]
+ * K random elements of a list, set, sorted set, hash (its fields), sample
+ * set or virtual key, all different unless WITHREPLACEMENT is given, or the
+ * whole key in random order if it has fewer. With STORE they replace dest as a
+ * list, whose length is the reply, and the writes are replicated as they
+ * are, since SRANDMEMBER picks are not made again the same. */
+int RandomPick_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  /* dest is a key too, for cluster slots and ACLs */
+  if (RedisModule_IsKeysPositionRequest(ctx))
+  {
+    if (argc > 1) RedisModule_KeyAtPos(ctx,1);
+    for (int i=3; i+1 < argc; i++)
+      if (!strcasecmp(RedisModule_StringPtrLen(argv[i],NULL),"STORE"))
+        RedisModule_KeyAtPos(ctx,++i);
+    return REDISMODULE_OK;
+  }
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_ENGINE | OPT_SEED, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  long long k;
+  if ((RedisModule_StringToLongLong(argv[2],&k) != REDISMODULE_OK) || (k < 0) || k > PICK_MAX_K)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  int repl = 0;
+  RedisModuleString *dest = NULL;
+  for (int i=3; i < argc; i++)
+  {
+    const char *s = RedisModule_StringPtrLen(argv[i],NULL);
+    if (!strcasecmp(s,"WITHREPLACEMENT"))
+      repl = 1;
+    else if (!strcasecmp(s,"STORE") && i+1 < argc)
+      dest = argv[++i];
+    else
+      return RedisModule_ReplyWithError(ctx,"ERR syntax error");
+  }
+
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+  int type = RedisModule_KeyType(key);
+  size_t len = type == REDISMODULE_KEYTYPE_MODULE ? 0 : RedisModule_ValueLength(key);
+  SampleSet *ss = GetSampleSet(key);
+  Recipe *r = GetRecipe(key);
+  RedisModule_CloseKey(key);
+  if (ss) len = ss->len;
+  if (r) len = RecipeLength(r);
+  if (type == REDISMODULE_KEYTYPE_STRING || (type == REDISMODULE_KEYTYPE_MODULE && !ss && !r))
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+
+  /* Positions, or the count for a set */
+  Engine &eng = opt.hasseed ? *seededEngines.engines[EngineIndex(opt.engine)] : *opt.engine;
+  if (opt.hasseed) eng.reseed(opt.seed);
+  if (len == 0) k = 0;
+  if (!repl && (uint64_t) k > len) k = len;
+  std::vector<uint64_t> pos;
+  if (type != REDISMODULE_KEYTYPE_SET)
+  {
+    if (repl)
+    {
+      pos.resize(k);
+      for (long long i=0; i < k; i++) pos[i] = BoundedWord(eng,eng(),len);
+    }
+    else
+      FloydPick(eng,len,k,pos);
+  }
+
+  std::vector<std::string> out;
+  const char *err = NULL;
+  if (k == 0)
+    ;
+  else if (type == REDISMODULE_KEYTYPE_LIST)
+    err = PickByIndex(ctx,argv[1],"LRANGE",pos,out);
+  else if (type == REDISMODULE_KEYTYPE_ZSET)
+    err = PickByIndex(ctx,argv[1],"ZRANGE",pos,out);
+  else if (type == REDISMODULE_KEYTYPE_HASH)
+    err = PickByScan(ctx,argv[1],pos,out);
+  else if (type == REDISMODULE_KEYTYPE_SET)
+    err = PickFromSet(ctx,argv[1],k,repl,eng,out);
+  else
+  {
+    /* Samples, as the l* commands would store them. Virtual samples are
+     * made a block at a time, once for all the positions in it. */
+    std::vector<double> v(k);
+    if (ss)
+      for (long long i=0; i < k; i++) v[i] = SampleSetGet(ss,pos[i]);
+    else
+    {
+      std::vector<std::pair<uint64_t,size_t>> order(k);
+      for (long long i=0; i < k; i++) order[i] = {pos[i],(size_t) i};
+      std::sort(order.begin(),order.end());
+      double buf[VIRTUAL_BLOCK];
+      uint64_t block = UINT64_MAX;
+      for (const auto &o : order)
+      {
+        if (o.first/VIRTUAL_BLOCK != block)
+        {
+          block = o.first/VIRTUAL_BLOCK;
+          RecipeFill(r,block*VIRTUAL_BLOCK,buf,std::min<uint64_t>(VIRTUAL_BLOCK,len-block*VIRTUAL_BLOCK));
+        }
+        v[o.second] = buf[o.first%VIRTUAL_BLOCK];
+      }
+    }
+    std::vector<char> text(k*SAMPLE_TEXT_MAX);
+    std::vector<uint32_t> ends(k);
+    FormatSamples(v.data(),k,text.data(),ends.data());
+    out.resize(k);
+    for (long long i=0; i < k; i++)
+    {
+      uint32_t start = i ? ends[i-1] : 0;
+      out[i].assign(&text[start],ends[i]-start);
+    }
+  }
+  if (err) return RedisModule_ReplyWithError(ctx,err);
+  curStats->samples += out.size();
+
+  if (dest == NULL)
+  {
+    RedisModule_ReplyWithArray(ctx,out.size());
+    for (const std::string &e : out)
+      RedisModule_ReplyWithStringBuffer(ctx,e.data(),e.size());
+    return REDISMODULE_OK;
+  }
+  RedisModuleKey *dkey = (RedisModuleKey *) RedisModule_OpenKey(ctx, dest, REDISMODULE_READ | REDISMODULE_WRITE);
+  RedisModule_DeleteKey(dkey);
+  std::vector<RedisModuleString *> elems;
+  elems.reserve(out.size());
+  for (const std::string &e : out)
+  {
+    elems.push_back(RedisModule_CreateString(ctx,e.data(),e.size()));
+    RedisModule_ListPush(dkey,REDISMODULE_LIST_TAIL,elems.back());
+  }
+  RedisModule_CloseKey(dkey);
+  RedisModule_Replicate(ctx,"DEL","s",dest);
+  for (size_t i=0; i < elems.size(); i += SAMPLESET_CHUNK)
+  {
+    std::vector<RedisModuleString *> args = {dest};
+    args.insert(args.end(),elems.begin()+i,elems.begin()+std::min(elems.size(),i+SAMPLESET_CHUNK));
+    RedisModule_Replicate(ctx,"RPUSH","v",args.data(),args.size());
+  }
+  for (RedisModuleString *e : elems) RedisModule_FreeString(ctx,e);
+  return RedisModule_ReplyWithLongLong(ctx,out.size());
+}
+
+/* Named samplers
+ * RANDOM.DEFINE parses a distribution and its parameters once into a Dist,
+ * with the constants its sampler needs worked out ahead, such as the
+ * alias table of a discrete distribution, and keeps it by name. Samplers
+ * read their Dist without changing it, so a worker may draw from it while
+ * the main thread does too, and hold it by a shared_ptr in case it is
+ * defined again meanwhile. The definitions are saved as given, as aux data
+ * of the RDB file, and parsed again on loading. */
+enum {
+  DIST_NORM,       /* MEAN SD */
+  DIST_LOGNORM,    /* MU SIGMA */
+  DIST_UNIF,       /* A B */
+  DIST_DUNIF,      /* A B, integers */
+  DIST_EXP,        /* LAMBDA */
+  DIST_GAMMA,      /* SHAPE SCALE */
+  DIST_POISSON,    /* LAMBDA */
+  DIST_DISCRETE,   /* W0 W1 ..., gives indices by weight */
+  DIST_MVNORM      /* MEAN... COV..., vectors, see RANDOM.LMVNORM */
+};
+
+struct DistSpec {
+  const char *name;
+  int kind;
+  int minargs, maxargs;
+};
+
+static const DistSpec DistSpecs[] = {
+  {"norm", DIST_NORM, 2, 2},
+  {"lognorm", DIST_LOGNORM, 2, 2},
+  {"unif", DIST_UNIF, 2, 2},
+  {"dunif", DIST_DUNIF, 2, 2},
+  {"exp", DIST_EXP, 1, 1},
+  {"gamma", DIST_GAMMA, 2, 2},
+  {"poisson", DIST_POISSON, 1, 1},
+  {"discrete", DIST_DISCRETE, 1, 1<<24},
+  {"mvnorm", DIST_MVNORM, 2, 1<<24},
+};
+
+/* Poisson means from which the PTRS sampler is used */
+#define DIST_POISSON_PTRS 10.0
+
+struct Dist {
+  std::vector<std::string> spec;   /* as given to RANDOM.DEFINE */
+  int kind;
+  int integer;                     /* samples are integers */
+  double p[6];                     /* parameters and constants */
+  std::vector<double> prob;        /* alias table of discrete */
+  std::vector<uint32_t> alias;
+  std::vector<double> mean;        /* of mvnorm */
+  std::vector<double> lt;          /* Cholesky factor of mvnorm, transposed */
+};
+
+const char *MvFactor(const std::vector<double> &a, Dist *d);
+
+std::unordered_map<std::string,std::shared_ptr<const Dist>> dists;
+
+/* Builds the alias table of w (Vose), where the column i is kept with
+ * probability prob[i] and gives alias[i] otherwise */
+void AliasBuild(const std::vector<double> &w, std::vector<double> &prob, std::vector<uint32_t> &alias) {
+  size_t n = w.size();
+  double sum = 0;
+  for (double x : w) sum += x;
+  prob.resize(n);
+  alias.resize(n);
+  std::vector<uint32_t> small, large;
+  for (size_t i=0; i < n; i++)
+  {
+    prob[i] = w[i]*n/sum;
+    alias[i] = i;
+    (prob[i] < 1 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty())
+  {
+    uint32_t s = small.back(), l = large.back();
+    small.pop_back();
+    alias[s] = l;
+    prob[l] -= 1-prob[s];
+    if (prob[l] < 1)
+    {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  /* Left over by rounding, all near 1 */
+  for (uint32_t i : small) prob[i] = 1;
+  for (uint32_t i : large) prob[i] = 1;
+}
+
+/* Column of an alias table of n columns drawn from word w, by the high
+ * bits of w*n, and whether it is kept, by the low bits */
+inline uint32_t AliasPick(const double *prob, const uint32_t *alias, uint64_t n, uint64_t w) {
+  unsigned __int128 m = (unsigned __int128) w * n;
+  uint32_t i = m >> 64;
+  return WordToUnit((uint64_t) m) < prob[i] ? i : alias[i];
+}
+
+/* Parses DIST PARAMS... into d, or returns an error message */
+const char *DistParse(const std::vector<std::string> &spec, Dist *d) {
+  const DistSpec *ds = NULL;
+  for (const DistSpec &s : DistSpecs)
+    if (!strcasecmp(spec[0].c_str(),s.name)) ds = &s;
+  if (ds == NULL) return "ERR unknown distribution";
+  size_t nargs = spec.size()-1;
+  if (nargs < (size_t) ds->minargs || nargs > (size_t) ds->maxargs)
+    return "ERR wrong number of distribution parameters";
+  std::vector<double> a(nargs);
+  for (size_t i=0; i < nargs; i++)
+    if (ParseSample(spec[i+1].data(),spec[i+1].size(),&a[i]) != REDISMODULE_OK ||
+        !std::isfinite(a[i]))
+      return "ERR invalid distribution parameter";
+
+  d->spec = spec;
+  d->kind = ds->kind;
+  d->integer = 0;
+  memset(d->p,0,sizeof(d->p));
+  switch (d->kind)
+  {
+  case DIST_NORM:
+  case DIST_LOGNORM:
+    if (a[1] < 0) return "ERR invalid standard deviation";
+    d->p[0] = a[0];
+    d->p[1] = a[1];
+    break;
+  case DIST_UNIF:
+    if (a[0] > a[1]) return "ERR invalid range";
+    d->p[0] = a[0];
+    d->p[1] = a[1];
+    break;
+  case DIST_DUNIF:
+    if (a[0] > a[1] || a[0] != std::floor(a[0]) || a[1] != std::floor(a[1]) ||
+        std::fabs(a[0]) > DIST_MAX_INT || std::fabs(a[1]) > DIST_MAX_INT)
+      return "ERR invalid range";
+    d->integer = 1;
+    d->p[0] = a[0];
+    d->p[1] = a[1]-a[0]+1;   /* values */
+    break;
+  case DIST_EXP:
+    if (!(a[0] > 0)) return "ERR invalid lambda";
+    d->p[0] = a[0];
+    break;
+  case DIST_GAMMA:
+    /* Marsaglia and Tsang, shapes below 1 by boosting to shape+1 */
+    if (!(a[0] > 0) || !(a[1] > 0)) return "ERR invalid shape or scale";
+    d->p[0] = (a[0] < 1 ? a[0]+1 : a[0]) - 1.0/3;
+    d->p[1] = 1/std::sqrt(9*d->p[0]);
+    d->p[2] = a[1];
+    d->p[3] = a[0] < 1 ? 1/a[0] : 0;
+    break;
+  case DIST_POISSON:
+    if (!(a[0] >= 0) || a[0] > 1e15) return "ERR invalid lambda";
+    d->integer = 1;
+    d->p[0] = a[0];
+    if (a[0] < DIST_POISSON_PTRS)
+      d->p[1] = std::exp(-a[0]);
+    else
+    {
+      /* PTRS, Hormann 1993 */
+      double b = 0.931 + 2.53*std::sqrt(a[0]);
+      d->p[1] = b;
+      d->p[2] = -0.059 + 0.02483*b;                /* a */
+      d->p[3] = std::log(1.1239 + 1.1328/(b-3.4)); /* log(1/alpha) */
+      d->p[4] = 0.9277 - 3.6224/(b-2);             /* vr */
+      d->p[5] = std::log(a[0]);
+    }
+    break;
+  case DIST_DISCRETE:
+  {
+    double sum = 0;
+    for (double x : a)
+    {
+      if (x < 0) return "ERR invalid weight";
+      sum += x;
+    }
+    if (!(sum > 0) || !std::isfinite(sum)) return "ERR invalid weight";
+    d->integer = 1;
+    AliasBuild(a,d->prob,d->alias);
+    break;
+  }
+  case DIST_MVNORM:
+    return MvFactor(a,d);
+  }
+  return NULL;
 }
 
-/* RANDOM.UNIF START END */
-int RandomUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  if (argc != 3) return RedisModule_WrongArity(ctx);
-  double start, end;
-  if (
-      (RedisModule_StringToDouble(argv[1],&start) != REDISMODULE_OK) ||
-      (RedisModule_StringToDouble(argv[2],&end) != REDISMODULE_OK) ||
-      (start > end) 
-      ) 
-    return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+inline double GammaSample(const Dist *d, Engine &eng) {
+  double dd = d->p[0], c = d->p[1];
+  for (;;)
+  {
+    double x = ZigNormal(eng,eng());
+    double v = 1 + c*x;
+    if (v <= 0) continue;
+    v = v*v*v;
+    double u = WordToUnit(eng());
+    if (u < 1 - 0.0331*x*x*x*x ||
+        std::log(u) < 0.5*x*x + dd*(1 - v + std::log(v)))
+    {
+      double g = dd*v;
+      if (d->p[3]) g *= std::pow(WordToUnit(eng()),d->p[3]);
+      return g*d->p[2];
+    }
+  }
+}
 
-  std::uniform_real_distribution<double> runif(start,end);
-  RedisModule_ReplyWithDouble(ctx,runif(gen));
-  return REDISMODULE_OK;
+inline double PoissonSample(const Dist *d, Engine &eng) {
+  double lambda = d->p[0];
+  if (lambda < DIST_POISSON_PTRS)
+  {
+    double p = 1;
+    long long k = -1;
+    do
+    {
+      k++;
+      p *= WordToUnit(eng());
+    } while (p > d->p[1]);
+    return k;
+  }
+  double b = d->p[1], a = d->p[2];
+  for (;;)
+  {
+    double u = WordToUnit(eng()) - 0.5;
+    double v = WordToUnit(eng());
+    double us = 0.5 - std::fabs(u);
+    double k = std::floor((2*a/us + b)*u + lambda + 0.43);
+    if (us >= 0.07 && v <= d->p[4]) return k;
+    if (k < 0 || (us < 0.013 && v > us)) continue;
+    if (std::log(v) + d->p[3] - std::log(a/(us*us) + b) <=
+        -lambda + k*d->p[5] - std::lgamma(k+1))
+      return k;
+  }
 }
 
-/* RANDOM.NORM [MEAN=0.0] [STDDEV=1.0] */
-int RandomNorm_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  double mean=0.0, sd=1.0;
-  if (argc > 3) return RedisModule_WrongArity(ctx);
-  if (argc >= 2) /* Get mean */
+/* Fills out with n samples of d */
+void DistFill(const Dist *d, Engine &eng, double *out, size_t n) {
+  switch (d->kind)
   {
-    if (RedisModule_StringToDouble(argv[1],&mean) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid mean");
+  case DIST_NORM:
+    NormalFill(eng,out,n,d->p[0],d->p[1]);
+    break;
+  case DIST_LOGNORM:
+    NormalFill(eng,out,n,d->p[0],d->p[1]);
+    for (size_t i=0; i < n; i++) out[i] = std::exp(out[i]);
+    break;
+  case DIST_UNIF:
+    UniformFill(eng,out,n,d->p[0],d->p[1]);
+    break;
+  case DIST_DUNIF:
+    DUnifFill(eng,out,n,(long long) d->p[0],(uint64_t) d->p[1]);
+    break;
+  case DIST_EXP:
+    ExpFill(eng,out,n,d->p[0]);
+    break;
+  case DIST_GAMMA:
+    for (size_t i=0; i < n; i++) out[i] = GammaSample(d,eng);
+    break;
+  case DIST_POISSON:
+    for (size_t i=0; i < n; i++) out[i] = PoissonSample(d,eng);
+    break;
+  case DIST_DISCRETE:
+    for (size_t i=0; i < n; i++)
+      out[i] = AliasPick(d->prob.data(),d->alias.data(),d->prob.size(),eng());
+    break;
   }
-  if (argc == 3) /* get stddev */
+}
+
+/* Finds a sampler by name, of vectors if multi is set and of numbers
+ * otherwise, or replies with an error and returns NULL */
+std::shared_ptr<const Dist> DistGet(RedisModuleCtx *ctx, RedisModuleString *name, int multi = 0) {
+  size_t len;
+  const char *p = RedisModule_StringPtrLen(name,&len);
+  auto it = dists.find(std::string(p,len));
+  if (it == dists.end())
   {
-    if (RedisModule_StringToDouble(argv[2],&sd) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid standard deviation");
+    RedisModule_ReplyWithError(ctx,"ERR no such sampler");
+    return NULL;
+  }
+  if ((it->second->kind == DIST_MVNORM) != (multi != 0))
+  {
+    RedisModule_ReplyWithError(ctx,multi ? "ERR not a multivariate sampler" :
+                               "ERR multivariate sampler, see RANDOM.LMVNORM");
+    return NULL;
+  }
+  return it->second;
+}
+
+/* Sampler definitions, saved once before the keys, the only time
+ * aux_save_triggers asks for. Redis has no such hook for AOF rewrites, so
+ * an AOF rewritten without the RDB preamble does not hold them. */
+void DistAuxSave(RedisModuleIO *rdb, int when) {
+  if (when != REDISMODULE_AUX_BEFORE_RDB) return;
+  RedisModule_SaveUnsigned(rdb,dists.size());
+  for (auto &it : dists)
+  {
+    RedisModule_SaveStringBuffer(rdb,it.first.data(),it.first.size());
+    RedisModule_SaveUnsigned(rdb,it.second->spec.size());
+    for (const std::string &s : it.second->spec)
+      RedisModule_SaveStringBuffer(rdb,s.data(),s.size());
   }
+}
 
-  std::normal_distribution<double> rnorm(mean,sd);
-  RedisModule_ReplyWithDouble(ctx, rnorm(gen));
+/* Loaded definitions replace the ones there were, as keys do. The aux
+ * data is versioned with the sample sets, its format the same in all. */
+int DistAuxLoad(RedisModuleIO *rdb, int encver, int when) {
+  if (encver > SAMPLESET_ENCVER || when != REDISMODULE_AUX_BEFORE_RDB) return REDISMODULE_ERR;
+  std::unordered_map<std::string,std::shared_ptr<const Dist>> loaded;
+  uint64_t n = RedisModule_LoadUnsigned(rdb);
+  for (uint64_t i=0; i < n; i++)
+  {
+    size_t len;
+    char *p = RedisModule_LoadStringBuffer(rdb,&len);
+    std::string name(p,len);
+    RedisModule_Free(p);
+    uint64_t nspec = RedisModule_LoadUnsigned(rdb);
+    if (nspec == 0 || nspec > (1<<24)+1) return REDISMODULE_ERR;
+    std::vector<std::string> spec;
+    for (uint64_t j=0; j < nspec; j++)
+    {
+      p = RedisModule_LoadStringBuffer(rdb,&len);
+      spec.emplace_back(p,len);
+      RedisModule_Free(p);
+    }
+    Dist *d = new Dist;
+    if (DistParse(spec,d))
+    {
+      RedisModule_LogIOError(rdb,"warning","Invalid sampler '%s'",name.c_str());
+      delete d;
+      return REDISMODULE_ERR;
+    }
+    loaded[name].reset(d);
+  }
+  dists.swap(loaded);
   return REDISMODULE_OK;
 }
-/* RANDOM.LUNIF KEY COUNT START END */
-int RandomLUnif_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  double start, end;
-  if (argc != 5) return RedisModule_WrongArity(ctx);
-  if (RedisModule_StringToDouble(argv[3],&start) != REDISMODULE_OK)
-    return RedisModule_ReplyWithError(ctx,"ERR invalid start");
-  if (RedisModule_StringToDouble(argv[4],&end) != REDISMODULE_OK)
-    return RedisModule_ReplyWithError(ctx,"ERR invalid end");
 
-  /* Open key */
-  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
- /* Key must be empty or list */
-  if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_LIST &&
-       RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY)) 
+/* RANDOM.DEFINE NAME DIST [PARAM ...]
+ * DIST is one of norm MEAN SD, lognorm MU SIGMA, unif A B, dunif A B,
+ * exp LAMBDA, gamma SHAPE SCALE, poisson LAMBDA, discrete W0 [W1 ...] */
+int RandomDefine_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+  std::vector<std::string> spec;
+  for (int i=2; i < argc; i++)
   {
-     RedisModule_CloseKey(key);
-     return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(argv[i],&len);
+    spec.emplace_back(p,len);
   }
+  Dist *d = new Dist;
+  const char *err = DistParse(spec,d);
+  if (err)
+  {
+    delete d;
+    return RedisModule_ReplyWithError(ctx,err);
+  }
+  size_t len;
+  const char *p = RedisModule_StringPtrLen(argv[1],&len);
+  dists[std::string(p,len)].reset(d);
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithSimpleString(ctx,"OK");
+}
+
+/* RANDOM.SAMPLE NAME [COUNT n] [ENGINE name] */
+int RandomSample_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_COUNT | OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 2) return RedisModule_WrongArity(ctx);
+  std::shared_ptr<const Dist> d = DistGet(ctx,argv[1]);
+  if (!d) return REDISMODULE_OK;
+
+  long long count = opt.count >= 0 ? opt.count : 1;
+  if (d->integer)
+  {
+    auto fill = [=](Engine &eng, long long *buf, int n) {
+      double v[SAMPLE_BATCH];
+      DistFill(d.get(),eng,v,n);
+      for (int i=0; i < n; i++) buf[i] = (long long) v[i];
+    };
+    if (opt.count >= 0) return ReplyWithSamples<long long>(ctx,count,opt.engine,fill);
+    long long ll;
+    curStats->samples++;
+    fill(*opt.engine,&ll,1);
+    return RedisModule_ReplyWithLongLong(ctx,ll);
+  }
+  auto fill = [=](Engine &eng, double *buf, int n) {
+    DistFill(d.get(),eng,buf,n);
+  };
+  if (opt.count >= 0) return ReplyWithSamples<double>(ctx,count,opt.engine,fill);
+  double v;
+  curStats->samples++;
+  fill(*opt.engine,&v,1);
+  return RedisModule_ReplyWithDouble(ctx,v);
+}
+
+/* RANDOM.LSAMPLE KEY NAME COUNT [PACKED] [ENGINE name]
+ *   [LIVEHIST cells min max] [SKETCH alpha] [SEED s] [TAIL] */
+int RandomLSample_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  int nargs = argc;
+  if (ParseOptions(ctx, argv, &argc, 4, OPT_PACKED | OPT_ENCODING | OPT_ENGINE | OPT_LIVEHIST | OPT_SKETCH | OPT_SEED | OPT_TAIL, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc != 4) return RedisModule_WrongArity(ctx);
+  std::shared_ptr<const Dist> d = DistGet(ctx,argv[2]);
+  if (!d) return REDISMODULE_OK;
+
+  /* Open key, must be empty, list or sample set */
+  SampleSink sink;
+  if (SampleSinkOpen(ctx, argv[1], &opt, &sink) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
 
   /* Get count */
   long long count;
-  if ((RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK) ||
-        (count < 0)) 
+  if ((RedisModule_StringToLongLong(argv[3],&count) != REDISMODULE_OK) ||
+        (count < 0))
   {
-     RedisModule_CloseKey(key);
+     RedisModule_CloseKey(sink.key);
      return RedisModule_ReplyWithError(ctx,"ERR invalid count");
   }
+  SampleSinkReserve(&sink, count);
+  if (opt.livecells || opt.alpha) SampleSinkLive(&sink, argv[1], &opt);
 
   /* Push count randoms */
-  std::uniform_real_distribution<double> runif(start,end);
-  while (count-- > 0)
+  SampleSinkRun(&sink, count, &opt, [=](Engine &eng, double *buf, size_t n) {
+    DistFill(d.get(),eng,buf,n);
+  });
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* Multivariate normals
+ * RANDOM.MVDEFINE keeps a mean vector and covariance matrix as a named
+ * sampler, like RANDOM.DEFINE, with the Cholesky factor L of the matrix
+ * worked out once. RANDOM.LMVNORM then makes each vector as mean + L z
+ * from a vector z of standard normals. L is kept transposed, each row
+ * padded to a multiple of 4, so that 4 coordinates of a column of L are
+ * one load. Vectors are made a block at a time, 4 coordinates at a time
+ * for the whole block so that their part of L stays in cache, and 4
+ * vectors at a time within it, with their sums in AVX2 registers, so that
+ * each load of L serves 16 products. The sums
+ * are the same with and without AVX2, as replicas and AOF loading must
+ * make the same vectors. */
+#define MV_MAX_DIM 1024
+#define MV_ROWS 4
+#define MV_BLOCK 32       /* fewest rows made at a time */
+
+inline size_t MvStride(size_t dim) {
+  return (dim+3) & ~(size_t) 3;
+}
+
+/* Sets up d from MEAN... COV..., the covariance matrix given by rows. It
+ * must be symmetric and positive semidefinite; singular matrices, as of
+ * coordinates that are sums of others, are taken. */
+const char *MvFactor(const std::vector<double> &a, Dist *d) {
+  size_t n = (size_t) ((std::sqrt(4.0*a.size()+1)-1)/2 + 0.5);
+  if (n*n+n != a.size()) return "ERR wrong number of distribution parameters";
+  if (n > MV_MAX_DIM) return "ERR dimension too large";
+  const double *cov = &a[n];
+  for (size_t i=0; i < n; i++)
   {
-    RedisModuleString *ele;
-    /* Make string with the same 19 digita precision of ReplyWithDouble */
-    ele=RedisModule_CreateStringPrintf(ctx,"%.19f",runif(gen));
-    RedisModule_ListPush(key,REDISMODULE_LIST_HEAD,ele);
-    RedisModule_FreeString(ctx,ele);
+    if (cov[i*n+i] < 0) return "ERR covariance not positive semidefinite";
+    for (size_t j=0; j < i; j++)
+      if (std::fabs(cov[i*n+j]-cov[j*n+i]) > 1e-9*std::sqrt(cov[i*n+i]*cov[j*n+j]))
+        return "ERR covariance not symmetric";
   }
- 
-  size_t len = RedisModule_ValueLength(key);
+
+  /* Cholesky-Crout by columns, into the transposed layout */
+  size_t stride = MvStride(n);
+  d->mean.assign(a.begin(),a.begin()+n);
+  d->lt.assign(n*stride,0);
+  double *lt = d->lt.data();
+  double eps = 1e-12*n;
+  for (size_t j=0; j < n; j++)
+  {
+    double v = cov[j*n+j];
+    for (size_t k=0; k < j; k++) v -= lt[k*stride+j]*lt[k*stride+j];
+    int zero = v <= eps*cov[j*n+j];
+    if (v < -eps*cov[j*n+j]) return "ERR covariance not positive semidefinite";
+    double ljj = zero ? 0 : std::sqrt(v);
+    lt[j*stride+j] = ljj;
+    for (size_t i=j+1; i < n; i++)
+    {
+      double c = cov[i*n+j];
+      for (size_t k=0; k < j; k++) c -= lt[k*stride+i]*lt[k*stride+j];
+      if (!zero) lt[j*stride+i] = c/ljj;
+      else if (std::fabs(c) > 1e-6*std::sqrt(cov[i*n+i]*cov[j*n+j]))
+        return "ERR covariance not positive semidefinite";
+    }
+  }
+  return NULL;
+}
+
+/* acc[r*stride+i] = sum over j of z[r*n+j]*L[i][j], for rows rows (a
+ * multiple of MV_ROWS), the terms added in order of j. Coordinates are
+ * done 4 at a time for all the rows, while their part of L is cached. */
+void MvRowsScalar(const double *lt, size_t n, const double *z, size_t rows, double *acc) {
+  size_t stride = MvStride(n);
+  for (size_t i=0; i < stride; i+=4)
+  {
+    size_t jend = i+4 < n ? i+4 : n;
+    for (size_t r=0; r < rows; r++)
+      for (size_t k=i; k < i+4; k++)
+      {
+        double y = 0;
+        for (size_t j=0; j < jend; j++) y += z[r*n+j]*lt[j*stride+k];
+        acc[r*stride+k] = y;
+      }
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+/* Same sums, 4 coordinates of MV_ROWS rows kept in registers over all j */
+__attribute__((target("avx2")))
+void MvRowsAVX2(const double *lt, size_t n, const double *z, size_t rows, double *acc) {
+  size_t stride = MvStride(n);
+  for (size_t i=0; i < stride; i+=4)
+  {
+    size_t jend = i+4 < n ? i+4 : n;
+    for (size_t r=0; r < rows; r+=MV_ROWS)
+    {
+      const double *zr = z+r*n;
+      __m256d y0 = _mm256_setzero_pd(), y1 = y0, y2 = y0, y3 = y0;
+      const double *l = lt+i;
+      for (size_t j=0; j < jend; j++, l += stride)
+      {
+        __m256d lj = _mm256_loadu_pd(l);
+        y0 = _mm256_add_pd(y0,_mm256_mul_pd(_mm256_set1_pd(zr[j]),lj));
+        y1 = _mm256_add_pd(y1,_mm256_mul_pd(_mm256_set1_pd(zr[n+j]),lj));
+        y2 = _mm256_add_pd(y2,_mm256_mul_pd(_mm256_set1_pd(zr[2*n+j]),lj));
+        y3 = _mm256_add_pd(y3,_mm256_mul_pd(_mm256_set1_pd(zr[3*n+j]),lj));
+      }
+      double *y = acc+r*stride+i;
+      _mm256_storeu_pd(y,y0);
+      _mm256_storeu_pd(y+stride,y1);
+      _mm256_storeu_pd(y+2*stride,y2);
+      _mm256_storeu_pd(y+3*stride,y3);
+    }
+  }
+}
+#endif
+
+/* Vectors of a multivariate sampler, handed out a coordinate at a time,
+ * so that any count of doubles can be asked for. Made a block of rows at
+ * a time from the engine given. */
+struct MvGen {
+  std::shared_ptr<const Dist> d;
+  size_t rows;                  /* a block, a multiple of MV_ROWS */
+  std::vector<double> z, acc, out;
+  size_t pos;                   /* doubles of out handed out */
+};
+
+std::shared_ptr<MvGen> MvGenNew(std::shared_ptr<const Dist> d) {
+  std::shared_ptr<MvGen> g = std::make_shared<MvGen>();
+  size_t n = d->mean.size();
+  g->d = d;
+  g->rows = (std::max(SAMPLE_BATCH/n,(size_t) MV_BLOCK) + MV_ROWS-1)/MV_ROWS*MV_ROWS;
+  g->z.resize(g->rows*n);
+  g->acc.resize(g->rows*MvStride(n));
+  g->out.resize(g->rows*n);
+  g->pos = g->out.size();
+  return g;
+}
+
+void MvGenBlock(MvGen *g, Engine &eng) {
+  const Dist *d = g->d.get();
+  size_t n = d->mean.size(), stride = MvStride(n);
+  NormalFill(eng,g->z.data(),g->z.size(),0,1);
+#ifdef HAVE_X86_SIMD
+  if (HaveAVX2) MvRowsAVX2(d->lt.data(),n,g->z.data(),g->rows,g->acc.data());
+  else
+#endif
+  MvRowsScalar(d->lt.data(),n,g->z.data(),g->rows,g->acc.data());
+  for (size_t r=0; r < g->rows; r++)
+    for (size_t i=0; i < n; i++)
+      g->out[r*n+i] = g->acc[r*stride+i] + d->mean[i];
+  g->pos = 0;
+}
+
+void MvFill(MvGen *g, Engine &eng, double *out, size_t n) {
+  while (n > 0)
+  {
+    if (g->pos == g->out.size()) MvGenBlock(g,eng);
+    size_t m = g->out.size()-g->pos < n ? g->out.size()-g->pos : n;
+    memcpy(out,&g->out[g->pos],m*sizeof(double));
+    g->pos += m;
+    out += m;
+    n -= m;
+  }
+}
+
+/* Pushes the coordinates of a chunk of rows, one key a coordinate */
+void MvSinkColumns(SampleSink *sinks, size_t n, const double *rows, size_t count) {
+  for (size_t k=0; k < n; k++)
+  {
+    SampleSinkReserve(&sinks[k],count);
+    const double *src = rows+k;
+    SampleSinkFill(&sinks[k], count, [&](double *out, size_t m) {
+      for (size_t i=0; i < m; i++, src += n) out[i] = *src;
+    });
+  }
+}
+
+/* Pushes count vectors of gen to the n keys, coordinate k to key k, as
+ * SampleSinkRun does for a key, and replies with the key lengths */
+void MvSinkRun(RedisModuleCtx *ctx, std::vector<SampleSink> &sinks, long long count, Options *opt, MvGen *gen) {
+  size_t n = sinks.size();
+  size_t chunk = ASYNC_CHUNK/n;
+  curStats->samples += count*n;
+  Engine &eng = *seededEngines.engines[EngineIndex(opt->engine)];
+  eng.reseed(opt->seed);
+  std::vector<double> buf(chunk*n);
+  for (long long left = count; left > 0; )
+  {
+    size_t m = left < (long long) chunk ? left : chunk;
+    MvFill(gen,eng,buf.data(),m*n);
+    MvSinkColumns(sinks.data(),n,buf.data(),m);
+    left -= m;
+  }
+  RedisModule_ReplyWithArray(ctx,n);
+  for (SampleSink &sink : sinks) RedisModule_ReplyWithLongLong(ctx,SampleSinkCommit(&sink));
+}
+
+/* RANDOM.MVDEFINE NAME MEAN... COV...
+ * Same as RANDOM.DEFINE NAME mvnorm MEAN... COV..., the covariance matrix
+ * by rows, so that a sampler of n dimensions takes n+n*n numbers */
+int RandomMvDefine_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 4) return RedisModule_WrongArity(ctx);
+  std::vector<std::string> spec = {"mvnorm"};
+  for (int i=2; i < argc; i++)
+  {
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(argv[i],&len);
+    spec.emplace_back(p,len);
+  }
+  Dist *d = new Dist;
+  const char *err = DistParse(spec,d);
+  if (err)
+  {
+    delete d;
+    return RedisModule_ReplyWithError(ctx,err);
+  }
+  size_t len;
+  const char *p = RedisModule_StringPtrLen(argv[1],&len);
+  dists[std::string(p,len)].reset(d);
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithSimpleString(ctx,"OK");
+}
+
+/* RANDOM.LMVNORM KEY [KEY ...] NAME COUNT [PACKED] [ENGINE name]
+ *   [LIVEHIST cells min max] [SKETCH alpha] [SEED s] [TAIL]
+ * Pushes COUNT vectors, one after the other to a single KEY, or with a
+ * KEY for each dimension, each coordinate to its own key */
+int RandomLMvNorm_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  int nargs = argc;
+  if (argc < 4) return RedisModule_WrongArity(ctx);
+  if (ParseOptions(ctx, argv, &argc, 4, OPT_PACKED | OPT_ENCODING | OPT_ENGINE | OPT_LIVEHIST | OPT_SKETCH | OPT_SEED | OPT_TAIL, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  std::shared_ptr<const Dist> d = DistGet(ctx,argv[argc-2],1);
+  if (!d) return REDISMODULE_OK;
+  size_t n = d->mean.size();
+  size_t nkeys = argc-3;
+  if (nkeys != 1 && nkeys != n)
+    return RedisModule_ReplyWithError(ctx,"ERR give one key, or one for each dimension");
+  long long count;
+  if ((RedisModule_StringToLongLong(argv[argc-1],&count) != REDISMODULE_OK) ||
+      (count < 0) || (count > INT64_MAX/(long long) n))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  std::vector<std::string> names;
+  for (size_t k=0; k < nkeys; k++)
+  {
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(argv[1+k],&len);
+    names.emplace_back(p,len);
+  }
+  if (std::unordered_set<std::string>(names.begin(),names.end()).size() != nkeys)
+    return RedisModule_ReplyWithError(ctx,"ERR keys must differ");
+
+  /* Open keys, each empty, list or sample set */
+  std::vector<SampleSink> sinks(nkeys);
+  for (size_t k=0; k < nkeys; k++)
+    if (SampleSinkOpen(ctx, argv[1+k], &opt, &sinks[k]) != REDISMODULE_OK)
+    {
+      for (size_t i=0; i < k; i++) RedisModule_CloseKey(sinks[i].key);
+      return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+  if (!opt.hasseed)
+  {
+    opt.seed = (*opt.engine)();
+    opt.hasseed = 1;
+  }
+  std::shared_ptr<MvGen> gen = MvGenNew(d);
+  if (nkeys == 1)
+  {
+    SampleSinkReserve(&sinks[0], count*n);
+    if (opt.livecells || opt.alpha) SampleSinkLive(&sinks[0], argv[1], &opt);
+    SampleSinkRun(&sinks[0], count*n, &opt, [=](Engine &eng, double *buf, size_t m) {
+      MvFill(gen.get(),eng,buf,m);
+    });
+  }
+  else
+  {
+    if (opt.livecells || opt.alpha)
+      for (size_t k=0; k < nkeys; k++) SampleSinkLive(&sinks[k], argv[1+k], &opt);
+    MvSinkRun(ctx, sinks, count, &opt, gen.get());
+  }
+  ReplicateSeeded(ctx, argv, nargs, argc, &opt);
+  return REDISMODULE_OK;
+}
+
+/* Simulations
+ * RANDOM.SIMHIST and RANDOM.SIMSTATS draw samples a batch at a time and
+ * fold each batch into histogram cells or running moments, so no sample
+ * is kept and memory does not grow with COUNT. Large counts run on a
+ * worker like the bulk replies. */
+
+/* Parses the distribution in argv[first..end), as given to RANDOM.DEFINE
+ * or the name of a defined sampler. Replies with an error and returns NULL
+ * if it is neither. */
+std::shared_ptr<const Dist> DistFromArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int first, int end) {
+  if (first >= end)
+  {
+    RedisModule_WrongArity(ctx);
+    return NULL;
+  }
+  std::vector<std::string> spec;
+  for (int i=first; i < end; i++)
+  {
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(argv[i],&len);
+    spec.emplace_back(p,len);
+  }
+  Dist *d = new Dist;
+  const char *err = DistParse(spec,d);
+  std::shared_ptr<const Dist> r;
+  if (err == NULL) r.reset(d);
+  else
+  {
+    delete d;
+    auto it = dists.find(spec[0]);
+    if (end-first != 1 || it == dists.end())
+    {
+      RedisModule_ReplyWithError(ctx,err);
+      return NULL;
+    }
+    r = it->second;
+  }
+  if (r->kind == DIST_MVNORM)
+  {
+    RedisModule_ReplyWithError(ctx,"ERR multivariate sampler, see RANDOM.LMVNORM");
+    return NULL;
+  }
+  return r;
+}
+
+/* Running count, mean and sums of powers of deviations from the mean,
+ * with min, max and the samples above a bound */
+struct Moments {
+  long long n;
+  double mean, m2, m3, m4;
+  double min, max;
+  long long above;
+};
+
+/* Adds a batch: its mean and deviations in two passes, then merged into m
+ * with the pairwise updates of Chan et al. and Pebay */
+void MomentsAdd(Moments *m, const double *v, size_t n, double above) {
+  if (n == 0) return;
+  double sum = 0, min = v[0], max = v[0];
+  long long na = 0;
+  for (size_t i=0; i < n; i++)
+  {
+    sum += v[i];
+    min = v[i] < min ? v[i] : min;
+    max = v[i] > max ? v[i] : max;
+    na += v[i] > above;
+  }
+  double mean = sum/n, m2 = 0, m3 = 0, m4 = 0;
+  for (size_t i=0; i < n; i++)
+  {
+    double d = v[i]-mean, d2 = d*d;
+    m2 += d2;
+    m3 += d2*d;
+    m4 += d2*d2;
+  }
+  if (m->n == 0)
+  {
+    m->min = min;
+    m->max = max;
+  }
+  double a = m->n, b = n, t = a+b;
+  double delta = mean - m->mean, d2 = delta*delta;
+  m->m4 += m4 + d2*d2*a*b*(a*a-a*b+b*b)/(t*t*t) +
+    6*d2*(a*a*m2+b*b*m->m2)/(t*t) + 4*delta*(a*m3-b*m->m3)/t;
+  m->m3 += m3 + d2*delta*a*b*(a-b)/(t*t) + 3*delta*(a*m2-b*m->m2)/t;
+  m->m2 += m2 + d2*a*b/t;
+  m->mean += delta*b/t;
+  m->n += n;
+  m->min = std::min(m->min,min);
+  m->max = std::max(m->max,max);
+  m->above += na;
+}
+
+/* Runs f(eng,buf,n) on batches of count samples of d, on a worker if count
+ * is large, then calls reply(ctx). The engine is a private one started
+ * from the SEED option if there is one. */
+template <class F, class R>
+void Simulate(RedisModuleCtx *ctx, std::shared_ptr<const Dist> d, long long count, Options *opt, F f, R reply) {
+  curStats->samples += count;
+  int hasseed = opt->hasseed;
+  uint64_t seed = opt->seed;
+  auto run = [=](RedisModuleCtx *ctx, Engine &eng) {
+    if (hasseed) eng.reseed(seed);
+    double buf[SAMPLE_BATCH];
+    for (long long left=count; left > 0; left -= SAMPLE_BATCH)
+    {
+      size_t n = left < SAMPLE_BATCH ? left : SAMPLE_BATCH;
+      DistFill(d.get(),eng,buf,n);
+      f(buf,n);
+    }
+    reply(ctx);
+  };
+  if (RunAsync(ctx,count,opt->engine,run)) return;
+  run(ctx, hasseed ? *seededEngines.engines[EngineIndex(opt->engine)] : *opt->engine);
+}
+
+/* RANDOM.SIMHIST DIST [PARAM ...] COUNT CELLS MIN MAX [ENGINE name] [SEED s]
+ * Histogram of COUNT samples of DIST, as RANDOM.HIST gives it */
+int RandomSimHist_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_ENGINE | OPT_SEED, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 6) return RedisModule_WrongArity(ctx);
+  long long count, cells;
+  double min, max;
+  if (RedisModule_StringToLongLong(argv[argc-4],&count) != REDISMODULE_OK || count < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  if (RedisModule_StringToLongLong(argv[argc-3],&cells) != REDISMODULE_OK ||
+      cells < 1 || cells > HIST_MAX_CELLS)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid hist size");
+  if (RedisModule_StringToDouble(argv[argc-2],&min) != REDISMODULE_OK ||
+      RedisModule_StringToDouble(argv[argc-1],&max) != REDISMODULE_OK || min > max)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid range");
+  std::shared_ptr<const Dist> d = DistFromArgs(ctx,argv,1,argc-4);
+  if (!d) return REDISMODULE_OK;
+
+  std::shared_ptr<std::vector<long long>> hist = std::make_shared<std::vector<long long>>(cells,0);
+  Simulate(ctx, d, count, &opt, [=](const double *v, size_t n) {
+    HistAdd(hist->data(),cells,min,max,v,n);
+  }, [=](RedisModuleCtx *ctx) {
+    HistReply(ctx,hist->data(),cells,0);
+  });
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.SIMSTATS DIST [PARAM ...] COUNT [ABOVE x] [ENGINE name] [SEED s]
+ * Count, mean, variance, standard deviation, min and max of COUNT samples
+ * of DIST, and with ABOVE the fraction of them above x */
+int RandomSimStats_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_ENGINE | OPT_SEED | OPT_ABOVE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+  long long count;
+  if (RedisModule_StringToLongLong(argv[argc-1],&count) != REDISMODULE_OK || count < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  std::shared_ptr<const Dist> d = DistFromArgs(ctx,argv,1,argc-1);
+  if (!d) return REDISMODULE_OK;
+
+  std::shared_ptr<Moments> m = std::make_shared<Moments>(Moments());
+  double above = opt.hasabove ? opt.above : INFINITY;
+  int hasabove = opt.hasabove;
+  Simulate(ctx, d, count, &opt, [=](const double *v, size_t n) {
+    MomentsAdd(m.get(),v,n,above);
+  }, [=](RedisModuleCtx *ctx) {
+    double var = m->n > 1 ? m->m2/(m->n-1) : 0;
+    RedisModule_ReplyWithArray(ctx,hasabove ? 14 : 12);
+    RedisModule_ReplyWithSimpleString(ctx,"count");
+    RedisModule_ReplyWithLongLong(ctx,m->n);
+    RedisModule_ReplyWithSimpleString(ctx,"mean");
+    RedisModule_ReplyWithDouble(ctx,m->mean);
+    RedisModule_ReplyWithSimpleString(ctx,"variance");
+    RedisModule_ReplyWithDouble(ctx,var);
+    RedisModule_ReplyWithSimpleString(ctx,"stddev");
+    RedisModule_ReplyWithDouble(ctx,std::sqrt(var));
+    RedisModule_ReplyWithSimpleString(ctx,"min");
+    RedisModule_ReplyWithDouble(ctx,m->min);
+    RedisModule_ReplyWithSimpleString(ctx,"max");
+    RedisModule_ReplyWithDouble(ctx,m->max);
+    if (hasabove)
+    {
+      RedisModule_ReplyWithSimpleString(ctx,"above");
+      RedisModule_ReplyWithDouble(ctx,m->n ? (double) m->above/m->n : 0);
+    }
+  });
+  return REDISMODULE_OK;
+}
+
+/* Summaries and fits of sample keys
+ * RANDOM.DESCRIBE folds the samples of a key into Moments in one pass of
+ * ScanSamples. RANDOM.FIT tests them against a distribution: the
+ * chi-square test counts them in cells of equal probability in one pass,
+ * and the Kolmogorov-Smirnov test needs them sorted, so they are copied
+ * and sorted on a worker when there are many. */
+
+/* Cumulative distribution of d at x, for the kinds that have one in closed
+ * form. Returns -1 for the others. */
+double DistCdf(const Dist *d, double x) {
+  switch (d->kind)
+  {
+  case DIST_LOGNORM:
+    if (x <= 0) return 0;
+    x = std::log(x);
+    /* fall through */
+  case DIST_NORM:
+    if (d->p[1] == 0) return x >= d->p[0] ? 1 : 0;
+    return 0.5*std::erfc((d->p[0]-x)/(d->p[1]*M_SQRT2));
+  case DIST_UNIF:
+    if (x < d->p[0]) return 0;
+    if (x >= d->p[1]) return 1;
+    return (x-d->p[0])/(d->p[1]-d->p[0]);
+  case DIST_EXP:
+    return x <= 0 ? 0 : -std::expm1(-d->p[0]*x);
+  }
+  return -1;
+}
+
+/* Probability that the Kolmogorov distribution exceeds l */
+double KolmogorovQ(double l) {
+  if (l < 0.2) return 1;
+  double q = 0, sign = 1;
+  for (int j=1; j <= 100; j++)
+  {
+    double t = std::exp(-2*j*j*l*l);
+    q += sign*t;
+    sign = -sign;
+    if (t < 1e-12) break;
+  }
+  return std::min(1.0,std::max(0.0,2*q));
+}
+
+/* Upper regularized incomplete gamma Q(a,x): a series below a+1 and a
+ * continued fraction above, as in Numerical Recipes */
+double GammaQ(double a, double x) {
+  if (x <= 0) return 1;
+  double lg = std::lgamma(a);
+  if (x < a+1)
+  {
+    double ap = a, sum = 1/a, del = sum;
+    for (int i=0; i < 1000 && std::fabs(del) > std::fabs(sum)*1e-15; i++)
+    {
+      ap += 1;
+      del *= x/ap;
+      sum += del;
+    }
+    return std::max(0.0, 1 - sum*std::exp(-x + a*std::log(x) - lg));
+  }
+  double b = x+1-a, c = 1e300, d = 1/b, h = d;
+  for (int i=1; i < 1000; i++)
+  {
+    double an = -i*(i-a);
+    b += 2;
+    d = an*d + b;
+    if (std::fabs(d) < 1e-300) d = 1e-300;
+    c = b + an/c;
+    if (std::fabs(c) < 1e-300) c = 1e-300;
+    d = 1/d;
+    double del = d*c;
+    h *= del;
+    if (std::fabs(del-1) < 1e-15) break;
+  }
+  return std::exp(-x + a*std::log(x) - lg)*h;
+}
+
+/* Cells of the chi-square test for n samples: 2n^(2/5), as Moore
+ * suggests, within [2,1000] */
+long long FitCells(size_t n) {
+  long long k = std::llround(2*std::pow((double) n,0.4));
+  return std::min(1000LL,std::max(2LL,k));
+}
+
+/* RANDOM.DESCRIBE KEY
+ * Count, mean, variance, skewness, excess kurtosis, min and max of the
+ * samples of a list or sample set */
+int RandomDescribe_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 2) return RedisModule_WrongArity(ctx);
+  Moments m = Moments();
+  const char *err = ScanSamples(ctx, argv[1], [&](const double *v, size_t n) {
+    MomentsAdd(&m,v,n,INFINITY);
+  });
+  if (err) return RedisModule_ReplyWithError(ctx,err);
+
+  double var = m.n > 1 ? m.m2/(m.n-1) : 0;
+  double skew = m.m2 > 0 ? std::sqrt((double) m.n)*m.m3/std::pow(m.m2,1.5) : 0;
+  double kurt = m.m2 > 0 ? m.n*m.m4/(m.m2*m.m2) - 3 : 0;
+  RedisModule_ReplyWithArray(ctx,14);
+  RedisModule_ReplyWithSimpleString(ctx,"count");
+  RedisModule_ReplyWithLongLong(ctx,m.n);
+  RedisModule_ReplyWithSimpleString(ctx,"mean");
+  RedisModule_ReplyWithDouble(ctx,m.mean);
+  RedisModule_ReplyWithSimpleString(ctx,"variance");
+  RedisModule_ReplyWithDouble(ctx,var);
+  RedisModule_ReplyWithSimpleString(ctx,"skewness");
+  RedisModule_ReplyWithDouble(ctx,skew);
+  RedisModule_ReplyWithSimpleString(ctx,"kurtosis");
+  RedisModule_ReplyWithDouble(ctx,kurt);
+  RedisModule_ReplyWithSimpleString(ctx,"min");
+  RedisModule_ReplyWithDouble(ctx,m.min);
+  RedisModule_ReplyWithSimpleString(ctx,"max");
+  RedisModule_ReplyWithDouble(ctx,m.max);
+  return REDISMODULE_OK;
+}
+
+/* RANDOM.FIT KEY DIST [PARAM ...]
+ * Tests the samples of a list or sample set against DIST, one of norm,
+ * lognorm, unif and exp with parameters as given to RANDOM.DEFINE or a
+ * defined sampler of these. Replies with the Kolmogorov-Smirnov statistic
+ * and its p-value, and the chi-square statistic, its degrees of freedom
+ * and p-value. */
+int RandomFit_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) return RedisModule_WrongArity(ctx);
+  std::shared_ptr<const Dist> d = DistFromArgs(ctx,argv,2,argc);
+  if (!d) return REDISMODULE_OK;
+  if (DistCdf(d.get(),0) < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR distribution has no closed form CDF");
+
+  std::shared_ptr<std::vector<double>> v = std::make_shared<std::vector<double>>();
+  const char *err = ScanSamples(ctx, argv[1], [&](const double *s, size_t n) {
+    v->insert(v->end(),s,s+n);
+  });
+  if (err) return RedisModule_ReplyWithError(ctx,err);
+  size_t n = v->size();
+  if (n == 0) return RedisModule_ReplyWithError(ctx,"ERR no samples");
+
+  auto fit = [=](RedisModuleCtx *ctx, Engine &) {
+    std::sort(v->begin(),v->end());
+    long long k = FitCells(n);
+    std::vector<long long> cells(k,0);
+    double D = 0;
+    for (size_t i=0; i < n; i++)
+    {
+      double F = DistCdf(d.get(),(*v)[i]);
+      D = std::max(D, std::max((double) (i+1)/n - F, F - (double) i/n));
+      long long c = (long long) (F*k);
+      cells[c < k ? c : k-1]++;
+    }
+    double sn = std::sqrt((double) n);
+    double ksp = KolmogorovQ((sn + 0.12 + 0.11/sn)*D);
+    double chi2 = 0, e = (double) n/k;
+    for (long long c : cells) chi2 += (c-e)*(c-e)/e;
+    RedisModule_ReplyWithArray(ctx,10);
+    RedisModule_ReplyWithSimpleString(ctx,"ks");
+    RedisModule_ReplyWithDouble(ctx,D);
+    RedisModule_ReplyWithSimpleString(ctx,"ks_pvalue");
+    RedisModule_ReplyWithDouble(ctx,ksp);
+    RedisModule_ReplyWithSimpleString(ctx,"chi2");
+    RedisModule_ReplyWithDouble(ctx,chi2);
+    RedisModule_ReplyWithSimpleString(ctx,"chi2_df");
+    RedisModule_ReplyWithLongLong(ctx,k-1);
+    RedisModule_ReplyWithSimpleString(ctx,"chi2_pvalue");
+    RedisModule_ReplyWithDouble(ctx,GammaQ((k-1)/2.0,chi2/2));
+  };
+  if (!RunAsync(ctx,n,defaultEngine,fit)) fit(ctx,*defaultEngine);
+  return REDISMODULE_OK;
+}
+
+/* Virtual keys
+ * RANDOM.LVIRTUAL makes a key that holds no samples, only how to make
+ * them: a count, a seed and a distribution. Sample i belongs to block
+ * i/VIRTUAL_BLOCK, and block b is drawn from stream b+1 of a Philox engine
+ * keyed by the seed, so a sample is made on demand by drawing its block
+ * alone, the same on every server. Readers of sample keys stream over
+ * them without keeping them, and replicas and AOF files get the recipe
+ * as one command. */
+static RedisModuleType *RecipeType;
+
+struct Recipe {
+  long long count;
+  uint64_t seed;
+  std::shared_ptr<const Dist> dist;   /* spec resolved, names not kept */
+};
+
+/* Returns the recipe held by key, or NULL */
+Recipe *GetRecipe(RedisModuleKey *key) {
+  if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_MODULE ||
+      RedisModule_ModuleTypeGetType(key) != RecipeType)
+    return NULL;
+  return (Recipe *) RedisModule_ModuleTypeGetValue(key);
+}
+
+long long RecipeLength(const Recipe *r) {
+  return r->count;
+}
+
+/* Samples start to start+n of the key, which must be within its length */
+void RecipeFill(const Recipe *r, long long start, double *out, size_t n) {
+  PhiloxEngine eng;
+  eng.seed(r->seed);
+  double buf[VIRTUAL_BLOCK];
+  while (n > 0)
+  {
+    long long b = start/VIRTUAL_BLOCK;
+    size_t off = start%VIRTUAL_BLOCK;
+    size_t m = VIRTUAL_BLOCK-off < n ? VIRTUAL_BLOCK-off : n;
+    eng.stream(b+1);
+    if (m == VIRTUAL_BLOCK)
+      DistFill(r->dist.get(),eng,out,VIRTUAL_BLOCK);
+    else
+    {
+      DistFill(r->dist.get(),eng,buf,VIRTUAL_BLOCK);
+      memcpy(out,buf+off,m*sizeof(double));
+    }
+    out += m;
+    start += m;
+    n -= m;
+  }
+}
+
+void RecipeFree(void *value) {
+  delete (Recipe *) value;
+}
+
+void *RecipeRdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver != 0) return NULL;
+  long long count = RedisModule_LoadSigned(rdb);
+  uint64_t seed = RedisModule_LoadUnsigned(rdb);
+  uint64_t nspec = RedisModule_LoadUnsigned(rdb);
+  if (nspec == 0 || nspec > (1<<24)+1) return NULL;
+  std::vector<std::string> spec;
+  for (uint64_t i=0; i < nspec; i++)
+  {
+    size_t len;
+    char *p = RedisModule_LoadStringBuffer(rdb,&len);
+    spec.emplace_back(p,len);
+    RedisModule_Free(p);
+  }
+  Dist *d = new Dist;
+  if (DistParse(spec,d))
+  {
+    RedisModule_LogIOError(rdb,"warning","Invalid virtual key sampler");
+    delete d;
+    return NULL;
+  }
+  Recipe *r = new Recipe;
+  r->count = count;
+  r->seed = seed;
+  r->dist.reset(d);
+  return r;
+}
+
+void RecipeRdbSave(RedisModuleIO *rdb, void *value) {
+  Recipe *r = (Recipe *) value;
+  RedisModule_SaveSigned(rdb,r->count);
+  RedisModule_SaveUnsigned(rdb,r->seed);
+  RedisModule_SaveUnsigned(rdb,r->dist->spec.size());
+  for (const std::string &s : r->dist->spec)
+    RedisModule_SaveStringBuffer(rdb,s.data(),s.size());
+}
+
+/* Arguments of the RANDOM.LVIRTUAL making r at key. All but the key are
+ * created here and left to the caller to free. */
+std::vector<RedisModuleString *> RecipeArgs(RedisModuleCtx *ctx, RedisModuleString *key, const Recipe *r) {
+  std::vector<RedisModuleString *> args;
+  args.push_back(key);
+  args.push_back(RedisModule_CreateStringFromLongLong(ctx,r->count));
+  for (const std::string &s : r->dist->spec)
+    args.push_back(RedisModule_CreateString(ctx,s.data(),s.size()));
+  args.push_back(RedisModule_CreateString(ctx,"SEED",4));
+  args.push_back(RedisModule_CreateStringFromLongLong(ctx,(long long) r->seed));
+  return args;
+}
+
+void RecipeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+  std::vector<RedisModuleString *> args = RecipeArgs(NULL,key,(Recipe *) value);
+  RedisModule_EmitAOF(aof,"random.lvirtual","v",args.data(),args.size());
+  for (size_t i=1; i < args.size(); i++)
+    RedisModule_FreeString(NULL,args[i]);
+}
+
+size_t RecipeMemUsage(const void *value) {
+  const Recipe *r = (const Recipe *) value;
+  size_t size = sizeof(Recipe) + sizeof(Dist) +
+    r->dist->prob.capacity()*sizeof(double) + r->dist->alias.capacity()*sizeof(uint32_t);
+  for (const std::string &s : r->dist->spec)
+    size += sizeof(std::string)+s.capacity();
+  return size;
+}
+
+void RecipeDigest(RedisModuleDigest *md, void *value) {
+  Recipe *r = (Recipe *) value;
+  RedisModule_DigestAddLongLong(md,r->count);
+  RedisModule_DigestAddLongLong(md,(long long) r->seed);
+  for (const std::string &s : r->dist->spec)
+    RedisModule_DigestAddStringBuffer(md,(unsigned char *) s.data(),s.size());
+  RedisModule_DigestEndSequence(md);
+}
+
+/* RANDOM.LVIRTUAL KEY COUNT DIST [PARAM ...] [SEED s]
+ * Replaces KEY with COUNT samples of DIST, given as to RANDOM.DEFINE or by
+ * the name of a sampler, that are made when read. Without SEED one is
+ * drawn, and replicated. */
+int RandomLVirtual_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 3, OPT_SEED, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 4) return RedisModule_WrongArity(ctx);
+  long long count;
+  if (RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK || count < 0)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+  std::shared_ptr<const Dist> d = DistFromArgs(ctx,argv,3,argc);
+  if (!d) return REDISMODULE_OK;
+
+  Recipe *r = new Recipe;
+  r->count = count;
+  r->seed = opt.hasseed ? opt.seed : (*defaultEngine)();
+  r->dist = d;
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  if (count > 0)
+    RedisModule_ModuleTypeSetValue(key,RecipeType,r);
+  else
+    RedisModule_DeleteKey(key);
   RedisModule_CloseKey(key);
-  RedisModule_ReplyWithLongLong(ctx, len);
-  return REDISMODULE_OK;
+  liveStats.erase(LiveStatsId(RedisModule_GetSelectedDb(ctx),argv[1]));
+
+  std::vector<RedisModuleString *> args = RecipeArgs(ctx,argv[1],r);
+  RedisModule_Replicate(ctx,"random.lvirtual","v",args.data(),args.size());
+  for (size_t i=1; i < args.size(); i++)
+    RedisModule_FreeString(ctx,args[i]);
+  if (count == 0) delete r;
+  return RedisModule_ReplyWithLongLong(ctx,count);
 }
 
-/* RANDOM.LNORM KEY COUNT [MEAN=0.0] [STDDEV=1.0] */
-int RandomLNorm_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  double mean=0.0, sd=1.0;
-  if (argc > 5) return RedisModule_WrongArity(ctx);
-  if (argc >= 4) /* Get mean */
+/* RANDOM.GET KEY INDEX
+ * Sample of a packed sample set or virtual key, indexed like LINDEX, or
+ * null if out of range */
+int RandomGet_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 3) return RedisModule_WrongArity(ctx);
+  long long index;
+  if (RedisModule_StringToLongLong(argv[2],&index) != REDISMODULE_OK)
+    return RedisModule_ReplyWithError(ctx,"ERR invalid index");
+
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY)
   {
-    if (RedisModule_StringToDouble(argv[3],&mean) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid mean");
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithNull(ctx);
   }
-  if (argc == 5) /* get stddev */
+  SampleSet *ss = GetSampleSet(key);
+  Recipe *r = GetRecipe(key);
+  RedisModule_CloseKey(key);
+  if (!ss && !r) return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  long long len = ss ? ss->len : RecipeLength(r);
+  if (index < 0) index += len;
+  if (index < 0 || index >= len) return RedisModule_ReplyWithNull(ctx);
+  double v;
+  if (ss)
+    v = SampleSetGet(ss,index);
+  else
   {
-    if (RedisModule_StringToDouble(argv[4],&sd) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid standard deviation");
+    RecipeFill(r,index,&v,1);
+    curStats->samples++;
   }
+  return RedisModule_ReplyWithDouble(ctx,v);
+}
 
-  /* Open key */
-  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
- /* Key must be empty or list */
-  if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_LIST &&
-       RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY)) 
+/* Weighted outcomes
+ * A weight set keeps the weight of each outcome, named or numbered from 0,
+ * and an alias table built over the weights as they were at the last
+ * build, so a pick takes constant time. Changing a few weights does not
+ * rebuild it: the table is sampled with acceptance w/u, where u is the
+ * weight of the outcome in the table and w its weight now, and the weight
+ * above u, of outcomes grown or added since, goes to a short excess list
+ * that is picked from directly. The table is rebuilt once the list grows
+ * past WEIGHT_EXCESS_MAX or less than half of the picks would be kept. */
+static RedisModuleType *WeightSetType;
+
+#define WEIGHT_EXCESS_MAX 64
+
+struct WeightSet {
+  std::vector<std::string> names;   /* empty for numbered outcomes */
+  std::unordered_map<std::string,uint32_t> index;
+  std::vector<double> w;            /* weights now */
+  double wsum;
+  std::vector<double> u;            /* weights in the table */
+  std::vector<double> prob;
+  std::vector<uint32_t> alias;
+  double usum;
+  std::vector<uint32_t> excess;     /* outcomes with w > u */
+  double esum;
+};
+
+void WeightSetFree(void *value) {
+  delete (WeightSet *) value;
+}
+
+void WeightSetBuild(WeightSet *ws) {
+  ws->u = ws->w;
+  ws->usum = 0;
+  for (double x : ws->u) ws->usum += x;
+  ws->wsum = ws->usum;
+  if (ws->usum > 0)
+    AliasBuild(ws->u,ws->prob,ws->alias);
+  else
   {
-     RedisModule_CloseKey(key);
-     return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    ws->prob.clear();
+    ws->alias.clear();
   }
+  ws->excess.clear();
+  ws->esum = 0;
+}
 
-  /* Get count */
-  long long count;
-  if ((RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK) ||
-        (count < 0)) 
+/* Sets the weight of outcome i, which may be one past the last */
+void WeightSetSet(WeightSet *ws, uint32_t i, double w) {
+  if (i == ws->w.size()) ws->w.push_back(0);
+  ws->wsum += w-ws->w[i];
+  ws->w[i] = w;
+  double u = i < ws->u.size() ? ws->u[i] : 0;
+  if (w > u && std::find(ws->excess.begin(),ws->excess.end(),i) == ws->excess.end())
+    ws->excess.push_back(i);
+  ws->esum = 0;
+  for (uint32_t j : ws->excess)
+    ws->esum += std::max(0.0, ws->w[j] - (j < ws->u.size() ? ws->u[j] : 0));
+}
+
+/* Rebuilds the table if picks got too slow */
+void WeightSetCheck(WeightSet *ws) {
+  if (ws->excess.size() > WEIGHT_EXCESS_MAX || ws->wsum < 0.5*(ws->usum+ws->esum))
+    WeightSetBuild(ws);
+}
+
+/* Returns an outcome picked by weight, there must be a positive weight */
+uint32_t WeightSetPick(const WeightSet *ws, Engine &eng) {
+  for (;;)
   {
-     RedisModule_CloseKey(key);
-     return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+    if (ws->esum > 0)
+    {
+      double x = WordToUnit(eng())*(ws->usum+ws->esum);
+      if (x < ws->esum)
+      {
+        uint32_t last = ws->excess[0];
+        for (uint32_t j : ws->excess)
+        {
+          double e = ws->w[j] - (j < ws->u.size() ? ws->u[j] : 0);
+          if (e <= 0) continue;
+          if (x < e) return j;
+          x -= e;
+          last = j;
+        }
+        return last;
+      }
+    }
+    uint32_t i = AliasPick(ws->prob.data(),ws->alias.data(),ws->prob.size(),eng());
+    if (ws->w[i] >= ws->u[i] || WordToUnit(eng())*ws->u[i] < ws->w[i])
+      return i;
   }
+}
 
-  /* Push count randoms */
-  std::normal_distribution<double> rnorm(mean,sd);
-  while (count-- > 0)
+/* Parses a weight, which must be finite and not negative */
+int ParseWeight(RedisModuleString *s, double *w) {
+  return RedisModule_StringToDouble(s,w) == REDISMODULE_OK && *w >= 0 &&
+    std::isfinite(*w) ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+void *WeightSetRdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver != 0) return NULL;
+  WeightSet *ws = new WeightSet;
+  uint64_t n = RedisModule_LoadUnsigned(rdb);
+  int named = RedisModule_LoadUnsigned(rdb);
+  ws->w.resize(n);
+  for (uint64_t i=0; i < n; i++)
   {
-    RedisModuleString *ele;
-    /* Make string with the same 19 digita precision of ReplyWithDouble */
-    ele=RedisModule_CreateStringPrintf(ctx,"%.19f",rnorm(gen));
-    RedisModule_ListPush(key,REDISMODULE_LIST_HEAD,ele);
-    RedisModule_FreeString(ctx,ele);
+    if (named)
+    {
+      size_t len;
+      char *p = RedisModule_LoadStringBuffer(rdb,&len);
+      ws->names.emplace_back(p,len);
+      ws->index[ws->names.back()] = i;
+      RedisModule_Free(p);
+    }
+    ws->w[i] = RedisModule_LoadDouble(rdb);
   }
- 
-  size_t len = RedisModule_ValueLength(key);
-  RedisModule_CloseKey(key);
-  RedisModule_ReplyWithLongLong(ctx, len);
-  return REDISMODULE_OK;
+  WeightSetBuild(ws);
+  return ws;
 }
 
-/* RANDOM.EXP [LAMBDA=1.0] */
-int RandomExp_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  double lambda;
-  if (argc > 2) return RedisModule_WrongArity(ctx);
-  if (argc == 2)
+void WeightSetRdbSave(RedisModuleIO *rdb, void *value) {
+  WeightSet *ws = (WeightSet *) value;
+  RedisModule_SaveUnsigned(rdb,ws->w.size());
+  RedisModule_SaveUnsigned(rdb,!ws->names.empty());
+  for (size_t i=0; i < ws->w.size(); i++)
   {
-    if (RedisModule_StringToDouble(argv[1],&lambda) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid lambda");
+    if (!ws->names.empty())
+      RedisModule_SaveStringBuffer(rdb,ws->names[i].data(),ws->names[i].size());
+    RedisModule_SaveDouble(rdb,ws->w[i]);
   }
-  else // If no parameter, use default lambda of 1
-    lambda=1.0;
-  std::exponential_distribution<double> rexp(lambda);
-  RedisModule_ReplyWithDouble(ctx, rexp(gen));
-  return REDISMODULE_OK;
 }
 
-/* RANDOM.LEXP KEY COUNT [LAMBDA=1.0] */
-int RandomLExp_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  double lambda;
-  if (argc < 3 || argc > 4) return RedisModule_WrongArity(ctx);
-  if (argc == 4)
+/* Rewritten as commands of WEIGHT_AOF_BATCH outcomes each: a RANDOM.WBUILD
+ * of the first outcomes if numbered, then RANDOM.WSET adding the rest. An
+ * empty set is a RANDOM.WBUILD without weights. */
+#define WEIGHT_AOF_BATCH 1000
+
+void WeightSetAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+  WeightSet *ws = (WeightSet *) value;
+  if (ws->w.empty())
   {
-    if (RedisModule_StringToDouble(argv[3],&lambda) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid lambda");
+    RedisModule_EmitAOF(aof,"random.wbuild","s",key);
+    return;
   }
-  else // If no parameter, use default lambda of 1
-    lambda=1.0;
-
-  /* Open key */
-  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
- /* Key must be empty or list */
-  if ((RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_LIST &&
-       RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_EMPTY)) 
+  int numbered = ws->names.empty();
+  std::vector<RedisModuleString *> args;
+  for (size_t i=0; i < ws->w.size(); i++)
   {
-     RedisModule_CloseKey(key);
-     return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    int build = numbered && i < WEIGHT_AOF_BATCH;
+    if (args.empty()) args.push_back(key);
+    if (!build)
+    {
+      if (numbered)
+        args.push_back(RedisModule_CreateStringFromLongLong(NULL,i));
+      else
+        args.push_back(RedisModule_CreateString(NULL,ws->names[i].data(),ws->names[i].size()));
+    }
+    char buf[32];
+    char *end = std::to_chars(buf,buf+sizeof(buf),ws->w[i]).ptr;
+    args.push_back(RedisModule_CreateString(NULL,buf,end-buf));
+    if (args.size() == 1+(build ? 1 : 2)*WEIGHT_AOF_BATCH || i+1 == ws->w.size())
+    {
+      RedisModule_EmitAOF(aof,build ? "random.wbuild" : "random.wset","v",args.data(),args.size());
+      for (size_t j=1; j < args.size(); j++)
+        RedisModule_FreeString(NULL,args[j]);
+      args.clear();
+    }
   }
+}
 
-  /* Get count */
-  long long count;
-  if ((RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK) ||
-        (count < 0)) 
+size_t WeightSetMemUsage(const void *value) {
+  const WeightSet *ws = (const WeightSet *) value;
+  size_t size = sizeof(WeightSet) + ws->w.capacity()*2*sizeof(double) +
+    ws->prob.capacity()*sizeof(double) + ws->alias.capacity()*sizeof(uint32_t);
+  for (const std::string &s : ws->names)
+    size += 2*(sizeof(std::string)+s.capacity()) + sizeof(uint32_t);
+  return size;
+}
+
+void WeightSetDigest(RedisModuleDigest *md, void *value) {
+  WeightSet *ws = (WeightSet *) value;
+  for (size_t i=0; i < ws->w.size(); i++)
   {
-     RedisModule_CloseKey(key);
-     return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+    if (!ws->names.empty())
+      RedisModule_DigestAddStringBuffer(md,(unsigned char *) ws->names[i].data(),ws->names[i].size());
+    char buf[sizeof(double)];
+    PackSamples(buf,&ws->w[i],1);
+    RedisModule_DigestAddStringBuffer(md,(unsigned char *) buf,sizeof(buf));
   }
+  RedisModule_DigestEndSequence(md);
+}
 
-  /* Push count randoms */
-  std::exponential_distribution<double> rexp(lambda);
-  while (count-- > 0)
+/* Reads the outcomes and weights of a hash, fields and values, or of a
+ * sorted set, members and scores, into ws. Returns NULL or an error. */
+const char *WeightSetFrom(RedisModuleCtx *ctx, RedisModuleString *keyname, WeightSet *ws) {
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, keyname, REDISMODULE_READ);
+  int type = RedisModule_KeyType(key);
+  RedisModule_CloseKey(key);
+  RedisModuleCallReply *reply;
+  if (type == REDISMODULE_KEYTYPE_HASH)
+    reply = RedisModule_Call(ctx,"HGETALL","s",keyname);
+  else if (type == REDISMODULE_KEYTYPE_ZSET)
+    reply = RedisModule_Call(ctx,"ZRANGE","sllc",keyname,0LL,-1LL,"WITHSCORES");
+  else if (type == REDISMODULE_KEYTYPE_EMPTY)
+    return "ERR no such key";
+  else
+    return REDISMODULE_ERRORMSG_WRONGTYPE;
+  if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY)
   {
-    RedisModuleString *ele;
-    /* Make string with the same 19 digita precision of ReplyWithDouble */
-    ele=RedisModule_CreateStringPrintf(ctx,"%.19f",rexp(gen));
-    RedisModule_ListPush(key,REDISMODULE_LIST_HEAD,ele);
-    RedisModule_FreeString(ctx,ele);
+    RedisModule_FreeCallReply(reply);
+    return "ERR error in key";
   }
- 
-  size_t len = RedisModule_ValueLength(key);
-  RedisModule_CloseKey(key);
-  RedisModule_ReplyWithLongLong(ctx, len);
-  return REDISMODULE_OK;
+  size_t n = RedisModule_CallReplyLength(reply);
+  for (size_t i=0; i+1 < n; i += 2)
+  {
+    size_t len, wlen;
+    const char *p = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply,i),&len);
+    const char *wp = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply,i+1),&wlen);
+    double w;
+    if (ParseSample(wp,wlen,&w) != REDISMODULE_OK || w < 0 || !std::isfinite(w))
+    {
+      RedisModule_FreeCallReply(reply);
+      return "ERR invalid weight";
+    }
+    ws->index[std::string(p,len)] = ws->names.size();
+    ws->names.emplace_back(p,len);
+    ws->w.push_back(w);
+  }
+  RedisModule_FreeCallReply(reply);
+  return NULL;
 }
 
-int RandomHist_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  if (argc > 4) return RedisModule_WrongArity(ctx);
-
-  long long slots=10;
-  long long col=0;
-
-  if (argc >= 3) 
+/* RANDOM.WBUILD KEY [WEIGHT ...]
+ * RANDOM.WBUILD KEY FROM SRC
+ * Replaces KEY by a weight set, with outcomes numbered from 0 with the
+ * given weights, or taken from a hash or sorted set. Without weights the
+ * set is empty, as AOF rewrites emit for one. */
+int RandomWBuild_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  int from = argc == 4 && !strcasecmp(RedisModule_StringPtrLen(argv[2],NULL),"FROM");
+  /* SRC is a key too, for cluster slots and ACLs */
+  if (RedisModule_IsKeysPositionRequest(ctx))
   {
-    if (RedisModule_StringToLongLong(argv[2],&slots) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid hist size");
+    if (argc > 1) RedisModule_KeyAtPos(ctx,1);
+    if (from) RedisModule_KeyAtPos(ctx,3);
+    return REDISMODULE_OK;
   }
-  if (argc == 4) 
+  if (argc < 2) return RedisModule_WrongArity(ctx);
+  WeightSet *ws = new WeightSet;
+  const char *err = NULL;
+  if (from)
+    err = WeightSetFrom(ctx,argv[3],ws);
+  else
   {
-    if (RedisModule_StringToLongLong(argv[3],&col) != REDISMODULE_OK)
-      return RedisModule_ReplyWithError(ctx,"ERR invalid columns size");
+    ws->w.resize(argc-2);
+    for (int i=2; i < argc && !err; i++)
+      if (ParseWeight(argv[i],&ws->w[i-2]) != REDISMODULE_OK)
+        err = "ERR invalid weight";
   }
-
-  /* Check key type */
-  RedisModuleKey * key = ( RedisModuleKey *) 
-    RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
-  if (RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_LIST)
+  if (!err && ws->w.size() > UINT32_MAX) err = "ERR too many outcomes";
+  if (err)
   {
-    RedisModule_CloseKey(key);
-    return RedisModule_ReplyWithError(ctx,"ERR key not of List type");
+    delete ws;
+    return RedisModule_ReplyWithError(ctx,err);
   }
+  WeightSetBuild(ws);
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  RedisModule_ModuleTypeSetValue(key,WeightSetType,ws);
   RedisModule_CloseKey(key);
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx,ws->w.size());
+}
 
-  long long hist[slots];
-  for (auto i=0; i < slots; i++) hist[i]=0;
-  RedisModuleCallReply *reply;
-  reply = RedisModule_Call(ctx,"LRANGE","scc",argv[1],"0","-1");
-
-  if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_NULL ||
-      RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR )
+/* RANDOM.WSET KEY OUTCOME WEIGHT [OUTCOME WEIGHT ...]
+ * Sets the weights of some outcomes, adding those not there. Outcomes of
+ * numbered sets are their numbers, and one past the last adds one. A
+ * missing key becomes a set of named outcomes. */
+int RandomWSet_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 4 || argc % 2) return RedisModule_WrongArity(ctx);
+  for (int i=3; i < argc; i += 2)
   {
-    RedisModule_FreeCallReply(reply);
-    return RedisModule_ReplyWithError(ctx,"ERR error in key");
+    double w;
+    if (ParseWeight(argv[i],&w) != REDISMODULE_OK)
+      return RedisModule_ReplyWithError(ctx,"ERR invalid weight");
   }
-
-  size_t len;
-  double min=0, max=0;
-  if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ARRAY)
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  WeightSet *ws;
+  int type = RedisModule_KeyType(key);
+  if (type == REDISMODULE_KEYTYPE_EMPTY)
+    ws = NULL;
+  else if (RedisModule_ModuleTypeGetType(key) == WeightSetType)
+    ws = (WeightSet *) RedisModule_ModuleTypeGetValue(key);
+  else
   {
-    len = RedisModule_CallReplyLength(reply);
-    if (len == 0)
-    {
-      RedisModule_FreeCallReply(reply);
-      return REDISMODULE_OK;
-    }
-    for (auto i=0; i < len; i++)
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+  int named = ws == NULL || !ws->names.empty() || ws->w.empty();
+  if (!named)
+  {
+    /* Numbers are checked first, so a bad one changes nothing */
+    long long n = ws->w.size();
+    for (int i=2; i < argc; i += 2)
     {
-      RedisModuleCallReply *subreply;
-      subreply = RedisModule_CallReplyArrayElement(reply,i);
-      double e;
-      RedisModuleString *ele = RedisModule_CreateStringFromCallReply(subreply);
-      if (RedisModule_StringToDouble(ele,&e)==REDISMODULE_ERR)
+      long long j;
+      if (RedisModule_StringToLongLong(argv[i],&j) != REDISMODULE_OK ||
+          j < 0 || j > n || j >= UINT32_MAX)
       {
-        RedisModule_FreeString(ctx,ele);
-        RedisModule_FreeCallReply(reply);
-        return RedisModule_ReplyWithError(ctx,"ERR bad list value");
+        RedisModule_CloseKey(key);
+        return RedisModule_ReplyWithError(ctx,"ERR invalid outcome");
       }
-      RedisModule_FreeString(ctx,ele);
-      if (i==0) min=max=e;
-      if (e < min) min=e;
-      if (e > max) max=e;
+      if (j == n) n++;
+    }
+  }
+  if (ws == NULL)
+  {
+    ws = new WeightSet;
+    WeightSetBuild(ws);
+    RedisModule_ModuleTypeSetValue(key,WeightSetType,ws);
+  }
+  for (int i=2; i < argc; i += 2)
+  {
+    double w;
+    ParseWeight(argv[i+1],&w);
+    uint32_t j;
+    size_t len;
+    const char *p = RedisModule_StringPtrLen(argv[i],&len);
+    if (named)
+    {
+      auto it = ws->index.try_emplace(std::string(p,len),ws->names.size());
+      if (it.second) ws->names.emplace_back(p,len);
+      j = it.first->second;
     }
-    double range=max-min;
-    for (auto i=0; i < len; i++)
+    else
     {
-      RedisModuleCallReply *subreply;
-      subreply = RedisModule_CallReplyArrayElement(reply,i);
-      double e;
-      RedisModuleString *ele = RedisModule_CreateStringFromCallReply(subreply);
-      RedisModule_StringToDouble(ele,&e);
-      RedisModule_FreeString(ctx,ele);
-      long long slot=(long long) std::floor(((e-min)/range)*slots);
-      if (slot==slots) slot--; /* max value goes to last slot */
-      hist[slot]++;
+      long long ll;
+      RedisModule_StringToLongLong(argv[i],&ll);
+      j = ll;
     }
+    WeightSetSet(ws,j,w);
+  }
+  WeightSetCheck(ws);
+  RedisModule_CloseKey(key);
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx,ws->w.size());
+}
+
+/* Replies with outcome i */
+inline void ReplyWithOutcome(RedisModuleCtx *ctx, const WeightSet *ws, uint32_t i) {
+  if (ws->names.empty())
+    RedisModule_ReplyWithLongLong(ctx,i);
+  else
+    RedisModule_ReplyWithStringBuffer(ctx,ws->names[i].data(),ws->names[i].size());
+}
 
+/* RANDOM.WPICK KEY [COUNT] [ENGINE name]
+ * Outcomes picked by weight, independently, or null when all weights are
+ * 0. Large counts are picked by a worker like the bulk replies, from a
+ * copy of the set, which RANDOM.WSET may change in the meantime. */
+int RandomWPick_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  Options opt;
+  if (ParseOptions(ctx, argv, &argc, 2, OPT_ENGINE, &opt) != REDISMODULE_OK)
+    return REDISMODULE_OK;
+  if (argc < 2 || argc > 3) return RedisModule_WrongArity(ctx);
+  long long count = -1;
+  if (argc == 3 &&
+      (RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK || count < 0))
+    return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+
+  RedisModuleKey *key = (RedisModuleKey *) RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+  int type = RedisModule_KeyType(key);
+  WeightSet *ws = NULL;
+  if (type == REDISMODULE_KEYTYPE_MODULE && RedisModule_ModuleTypeGetType(key) == WeightSetType)
+    ws = (WeightSet *) RedisModule_ModuleTypeGetValue(key);
+  RedisModule_CloseKey(key);
+  if (type != REDISMODULE_KEYTYPE_EMPTY && ws == NULL)
+    return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+  if (ws == NULL || !(ws->usum+ws->esum > 0))
+    return count < 0 ? RedisModule_ReplyWithNull(ctx) : RedisModule_ReplyWithArray(ctx,0);
+
+  Engine &eng = *opt.engine;
+  if (count < 0)
+  {
+    curStats->samples++;
+    ReplyWithOutcome(ctx,ws,WeightSetPick(ws,eng));
+    return REDISMODULE_OK;
   }
-  RedisModule_FreeCallReply(reply);
+  curStats->samples += count;
+  std::shared_ptr<const WeightSet> copy;
+  if (!workers.empty() && count >= asyncCount) copy = std::make_shared<WeightSet>(*ws);
+  auto reply = [=](RedisModuleCtx *ctx, Engine &eng) {
+    const WeightSet *w = copy ? copy.get() : ws;
+    RedisModule_ReplyWithArray(ctx,count);
+    for (long long i=0; i < count; i++)
+      ReplyWithOutcome(ctx,w,WeightSetPick(w,eng));
+  };
+  if (!copy || !RunAsync(ctx,count,opt.engine,reply)) reply(ctx,eng);
+  return REDISMODULE_OK;
+}
 
-  RedisModule_ReplyWithArray(ctx,slots);
-  if (col==0)
+/* RANDOM.STATS [RESET]
+ * For each command called since loading or the last RESET: calls, samples
+ * generated, time on the main thread, calls handed to workers, bytes
+ * written to keys, samples scanned
+ * and their rate, and a latency histogram as pairs of the upper bound of
+ * each power of two bucket, in microseconds, and its calls. */
+int RandomStats_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc > 2) return RedisModule_WrongArity(ctx);
+  if (argc == 2)
   {
-    for (auto i=0; i < slots; i++)
-      RedisModule_ReplyWithLongLong(ctx,hist[i]);
+    if (strcasecmp(RedisModule_StringPtrLen(argv[1],NULL),"RESET"))
+      return RedisModule_ReplyWithError(ctx,"ERR syntax error");
+    for (CommandStats *cs : commandStats)
+    {
+      std::string name = cs->name;
+      *cs = CommandStats();
+      cs->name = name;
+    }
+    return RedisModule_ReplyWithSimpleString(ctx,"OK");
   }
-  else
+
+  double rate = StatsTicksPerUsec();
+
+  std::vector<CommandStats *> list;
+  for (CommandStats *cs : commandStats)
+    if (cs->calls) list.push_back(cs);
+  std::sort(list.begin(), list.end(), [](CommandStats *a, CommandStats *b) {
+    return a->name < b->name;
+  });
+  RedisModule_ReplyWithArray(ctx,list.size());
+  for (CommandStats *cs : list)
   {
-    char s[col];
-    for (auto i=0; i < col; i++)
-      s[i] = {'*'};
-    double hmax=hist[0];
-    for (auto i=0; i < slots; i++)
-      if (hmax < hist[i]) 
-        hmax = hist[i];
-    for (auto i=0; i < slots; i++)
-      RedisModule_ReplyWithStringBuffer(ctx,s,std::floor(((double) hist[i])/hmax*col));
+    int buckets = 0;
+    for (int i=0; i < 64; i++) buckets += cs->latency[i] != 0;
+    RedisModule_ReplyWithArray(ctx,19);
+    RedisModule_ReplyWithStringBuffer(ctx,cs->name.data(),cs->name.size());
+    RedisModule_ReplyWithSimpleString(ctx,"calls");
+    RedisModule_ReplyWithLongLong(ctx,cs->calls);
+    RedisModule_ReplyWithSimpleString(ctx,"samples");
+    RedisModule_ReplyWithLongLong(ctx,cs->samples);
+    RedisModule_ReplyWithSimpleString(ctx,"usec");
+    RedisModule_ReplyWithDouble(ctx,cs->ticks/rate);
+    RedisModule_ReplyWithSimpleString(ctx,"max_usec");
+    RedisModule_ReplyWithDouble(ctx,cs->maxticks/rate);
+    RedisModule_ReplyWithSimpleString(ctx,"async");
+    RedisModule_ReplyWithLongLong(ctx,cs->async);
+    RedisModule_ReplyWithSimpleString(ctx,"bytes");
+    RedisModule_ReplyWithLongLong(ctx,cs->bytes);
+    RedisModule_ReplyWithSimpleString(ctx,"scanned");
+    RedisModule_ReplyWithLongLong(ctx,cs->scanned);
+    RedisModule_ReplyWithSimpleString(ctx,"scanned_per_sec");
+    RedisModule_ReplyWithDouble(ctx,cs->scanticks ? cs->scanned/(cs->scanticks/rate)*1e6 : 0);
+    RedisModule_ReplyWithSimpleString(ctx,"latency");
+    RedisModule_ReplyWithArray(ctx,2*buckets);
+    for (int i=0; i < 64; i++)
+    {
+      if (!cs->latency[i]) continue;
+      RedisModule_ReplyWithDouble(ctx,std::ldexp(1.0,i+1)/rate);
+      RedisModule_ReplyWithLongLong(ctx,cs->latency[i]);
+    }
   }
   return REDISMODULE_OK;
 }
 
-
 int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (RedisModule_Init(ctx,"random",1,REDISMODULE_APIVER_1)
         == REDISMODULE_ERR) return REDISMODULE_ERR;
 
+#ifdef HAVE_X86_SIMD
+    HaveAVX2 = __builtin_cpu_supports("avx2");
+#endif
+    ZigguratInit();
+    statsTicks0 = StatsClock();
+    statsTime0 = std::chrono::steady_clock::now();
+
+    /* The mt19937 engine keeps the seed gen got from rd */
+    for (size_t i=1; i < sizeof(Engines)/sizeof(Engines[0]); i++)
+      Engines[i]->reseed(((uint64_t) rd() << 32) | rd());
+    SecureRekey();
+
+    /* Load arguments: ENGINE name, THREADS n, ASYNC count, RINGS n */
+    long long threads = 2, ringsize = 0;
+    for (int i=0; i < argc; i++)
+    {
+      const char *s = RedisModule_StringPtrLen(argv[i],NULL);
+      if (!strcasecmp(s,"ENGINE") && i+1 < argc)
+      {
+        const char *name = RedisModule_StringPtrLen(argv[++i],NULL);
+        defaultEngine = EngineByName(name);
+        if (defaultEngine == NULL)
+        {
+          RedisModule_Log(ctx,"warning","Unknown engine '%s'",name);
+          return REDISMODULE_ERR;
+        }
+      }
+      else if ((!strcasecmp(s,"THREADS") || !strcasecmp(s,"ASYNC")) && i+1 < argc)
+      {
+        long long n;
+        if ((RedisModule_StringToLongLong(argv[++i],&n) != REDISMODULE_OK) ||
+            (n < 0) || (!strcasecmp(s,"THREADS") && n > 256))
+        {
+          RedisModule_Log(ctx,"warning","Invalid %s value",s);
+          return REDISMODULE_ERR;
+        }
+        if (!strcasecmp(s,"THREADS")) threads = n;
+        else asyncCount = n;
+      }
+      else if (!strcasecmp(s,"RINGS") && i+1 < argc)
+      {
+        if ((RedisModule_StringToLongLong(argv[++i],&ringsize) != REDISMODULE_OK) ||
+            (ringsize < 0) || (ringsize > RING_MAX_SIZE))
+        {
+          RedisModule_Log(ctx,"warning","Invalid RINGS value");
+          return REDISMODULE_ERR;
+        }
+      }
+      else
+      {
+        RedisModule_Log(ctx,"warning","Unknown module argument '%s'",s);
+        return REDISMODULE_ERR;
+      }
+    }
+
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx,
+        REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_LIST |
+        REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED,
+        LiveStatsNotify) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    RedisModuleTypeMethods tm;
+    memset(&tm,0,sizeof(tm));
+    tm.version = REDISMODULE_TYPE_METHOD_VERSION;
+    tm.rdb_load = SampleSetRdbLoad;
+    tm.rdb_save = SampleSetRdbSave;
+    tm.aof_rewrite = SampleSetAofRewrite;
+    tm.mem_usage = SampleSetMemUsage;
+    tm.digest = SampleSetDigest;
+    tm.free = SampleSetFree;
+    tm.aux_load = DistAuxLoad;
+    tm.aux_save = DistAuxSave;
+    tm.aux_save_triggers = REDISMODULE_AUX_BEFORE_RDB;
+    SampleSetType = RedisModule_CreateDataType(ctx,"rndsample",SAMPLESET_ENCVER,&tm);
+    if (SampleSetType == NULL) return REDISMODULE_ERR;
+
+    memset(&tm,0,sizeof(tm));
+    tm.version = REDISMODULE_TYPE_METHOD_VERSION;
+    tm.rdb_load = SketchRdbLoad;
+    tm.rdb_save = SketchRdbSave;
+    tm.aof_rewrite = SketchAofRewrite;
+    tm.mem_usage = SketchMemUsage;
+    tm.digest = SketchDigest;
+    tm.free = SketchFree;
+    SketchType = RedisModule_CreateDataType(ctx,"rndsketch",0,&tm);
+    if (SketchType == NULL) return REDISMODULE_ERR;
+
+    memset(&tm,0,sizeof(tm));
+    tm.version = REDISMODULE_TYPE_METHOD_VERSION;
+    tm.rdb_load = WeightSetRdbLoad;
+    tm.rdb_save = WeightSetRdbSave;
+    tm.aof_rewrite = WeightSetAofRewrite;
+    tm.mem_usage = WeightSetMemUsage;
+    tm.digest = WeightSetDigest;
+    tm.free = WeightSetFree;
+    WeightSetType = RedisModule_CreateDataType(ctx,"rndweight",0,&tm);
+    if (WeightSetType == NULL) return REDISMODULE_ERR;
+
+    memset(&tm,0,sizeof(tm));
+    tm.version = REDISMODULE_TYPE_METHOD_VERSION;
+    tm.rdb_load = RecipeRdbLoad;
+    tm.rdb_save = RecipeRdbSave;
+    tm.aof_rewrite = RecipeAofRewrite;
+    tm.mem_usage = RecipeMemUsage;
+    tm.digest = RecipeDigest;
+    tm.free = RecipeFree;
+    RecipeType = RedisModule_CreateDataType(ctx,"rndrecipe",0,&tm);
+    if (RecipeType == NULL) return REDISMODULE_ERR;
+
     if (RedisModule_CreateCommand(ctx,"random.dunif",
-        RandomDUnif_RedisCommand,"readonly random",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomDUnif_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.ldunif",
+        Timed<RandomLDUnif_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.dsample",
+        Timed<RandomDSample_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx,"random.unif",
-        RandomUnif_RedisCommand,"readonly random",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomUnif_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx,"random.lunif",
-        RandomLUnif_RedisCommand,"random",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomLUnif_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx,"random.norm",
-        RandomNorm_RedisCommand,"readonly random",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomNorm_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx,"random.lnorm",
-        RandomLNorm_RedisCommand,"random",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomLNorm_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx,"random.exp",
-        RandomExp_RedisCommand,"readonly random",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomExp_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx,"random.lexp",
-        RandomLExp_RedisCommand,"random",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomLExp_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.zunif",
+        Timed<RandomZUnif_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.znorm",
+        Timed<RandomZNorm_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.zexp",
+        Timed<RandomZExp_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.bytes",
+        Timed<RandomBytes_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.token",
+        Timed<RandomToken_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.sobol",
+        Timed<RandomSobol_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.halton",
+        Timed<RandomHalton_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.lsobol",
+        Timed<RandomLSobol_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.lhalton",
+        Timed<RandomLHalton_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.pick",
+        Timed<RandomPick_RedisCommand>,"write deny-oom random getkeys-api",1,1,1) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
     if (RedisModule_CreateCommand(ctx,"random.hist",
-        RandomHist_RedisCommand,"readonly",0,0,0) == REDISMODULE_ERR)
+        Timed<RandomHist_RedisCommand>,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.sload",
+        Timed<RandomSLoad_RedisCommand>,"write deny-oom",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.range",
+        Timed<RandomRange_RedisCommand>,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.get",
+        Timed<RandomGet_RedisCommand>,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.lvirtual",
+        Timed<RandomLVirtual_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.livehist",
+        Timed<RandomLiveHist_RedisCommand>,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.quantile",
+        Timed<RandomQuantile_RedisCommand>,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.qadd",
+        Timed<RandomQAdd_RedisCommand>,"write deny-oom",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.qbuild",
+        Timed<RandomQBuild_RedisCommand>,"write deny-oom",1,2,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.qexport",
+        Timed<RandomQExport_RedisCommand>,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.qmerge",
+        Timed<RandomQMerge_RedisCommand>,"write deny-oom",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.define",
+        Timed<RandomDefine_RedisCommand>,"write deny-oom",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.sample",
+        Timed<RandomSample_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.lsample",
+        Timed<RandomLSample_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.mvdefine",
+        Timed<RandomMvDefine_RedisCommand>,"write deny-oom",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.lmvnorm",
+        Timed<RandomLMvNorm_RedisCommand>,"write deny-oom random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.simhist",
+        Timed<RandomSimHist_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.simstats",
+        Timed<RandomSimStats_RedisCommand>,"readonly random",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.describe",
+        Timed<RandomDescribe_RedisCommand>,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.fit",
+        Timed<RandomFit_RedisCommand>,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.wbuild",
+        Timed<RandomWBuild_RedisCommand>,"write deny-oom getkeys-api",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.wset",
+        Timed<RandomWSet_RedisCommand>,"write deny-oom",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.wpick",
+        Timed<RandomWPick_RedisCommand>,"readonly random",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.stats",
+        RandomStats_RedisCommand,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"random.rings",
+        RandomRings_RedisCommand,"readonly",0,0,0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
 
+    StartWorkers(threads);
+    StartRings(ringsize);
     return REDISMODULE_OK;
 }
@@ -0,0 +1,92 @@
+/* Command throughput: every command run as a client would, through the
+ * stand-in module API of mockapi.h, so the reply formatting, key writes
+ * and parsing are timed along with the sampling. The module is loaded
+ * with no threads, so large counts run inline. For numbers against a
+ * real server see redis-benchmark.sh. */
+#include "../Random.cc"
+#include "mockapi.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* Runs args reps times and reports per sample figures for count samples
+ * per run */
+void Report(const char *name, long long count, int reps,
+            std::vector<std::string> args, const char *cleanup = NULL) {
+  long long allocs = mockAllocs, bytes = mockReplyBytes;
+  double s = 0;
+  for (int r=0; r < reps; r++)
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    if (!MockRun(args))
+    {
+      printf("%-44s %s\n", name, mockError.c_str());
+      return;
+    }
+    s += std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    if (cleanup) MockDelete(cleanup);
+  }
+  double n = (double) count*reps;
+  printf("%-44s %8.2f Msamples/s %8.2f ns/sample %6.2f allocs/sample %6.2f bytes/sample\n",
+         name, n/s/1e6, s*1e9/n, (mockAllocs-allocs)/n, (mockReplyBytes-bytes)/n);
+}
+
+/* Enough runs for about 10M samples, at least 3 */
+int Reps(long long count) {
+  return std::max(3LL,10000000/count);
+}
+
+int main() {
+  MockLoad({"THREADS","0"});
+  const long long counts[] = {1,100,10000,1000000};
+  char name[128];
+
+  printf("Bulk replies\n");
+  for (long long c : counts)
+  {
+    std::string n = std::to_string(c);
+    int reps = c == 1 ? 1000000 : Reps(c);
+    snprintf(name,sizeof(name),"random.norm COUNT %lld",c);
+    Report(name,c,reps,{"random.norm","0","1","COUNT",n});
+    snprintf(name,sizeof(name),"random.unif COUNT %lld",c);
+    Report(name,c,reps,{"random.unif","0","1","COUNT",n});
+    snprintf(name,sizeof(name),"random.dunif COUNT %lld",c);
+    Report(name,c,reps,{"random.dunif","1","6","COUNT",n});
+    snprintf(name,sizeof(name),"random.exp COUNT %lld",c);
+    Report(name,c,reps,{"random.exp","1","COUNT",n});
+  }
+
+  printf("\nFills\n");
+  for (long long c : {1000LL,100000LL,1000000LL})
+  {
+    std::string n = std::to_string(c);
+    for (const char *cmd : {"random.lunif","random.lnorm","random.lexp"})
+    {
+      std::vector<std::string> args = {cmd,"bench",n};
+      if (!strcmp(cmd,"random.lunif"))
+      {
+        args.push_back("0");
+        args.push_back("1");
+      }
+      snprintf(name,sizeof(name),"%s %lld",cmd,c);
+      Report(name,c,Reps(c),args,"bench");
+      args.push_back("PACKED");
+      snprintf(name,sizeof(name),"%s %lld PACKED",cmd,c);
+      Report(name,c,Reps(c),args,"bench");
+    }
+  }
+
+  printf("\nHistograms of 1M samples\n");
+  MockRun({"random.lnorm","list","1000000"});
+  MockRun({"random.lnorm","packed","1000000","PACKED"});
+  for (const char *key : {"list","packed"})
+    for (const char *cells : {"10","1000","100000"})
+    {
+      snprintf(name,sizeof(name),"random.hist %s %s",key,cells);
+      Report(name,1000000,3,{"random.hist",key,cells});
+      snprintf(name,sizeof(name),"random.hist %s %s MIN -5 MAX 5",key,cells);
+      Report(name,1000000,3,{"random.hist",key,cells,"MIN","-5","MAX","5"});
+    }
+  return 0;
+}
@@ -0,0 +1,365 @@
+/* An in-process stand-in for the parts of the Redis module API used by
+ * Random.cc, so its commands can be timed without a server. Include it
+ * after Random.cc. Keys live in a map, lists are deques of strings, and
+ * replies are formatted the way Redis formats them, then dropped, with
+ * their size kept. Calls to RedisModule_Call support LRANGE and LLEN.
+ *
+ * mockAllocs counts the allocations the module asks for: the Alloc family
+ * and every RedisModuleString made, three for CreateStringPrintf as in
+ * Redis (an empty sds, its growth and the object). Allocations inside
+ * Redis itself, such as list nodes, are not counted. */
+#include <charconv>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+long long mockAllocs;
+long long mockReplyBytes;
+std::string mockError;   /* last error replied */
+
+struct RedisModuleString {
+  std::string s;
+};
+
+struct RedisModuleCtx {
+  void *getapi;   /* must come first, see RedisModule_Init */
+};
+
+struct RedisModuleType {
+  RedisModuleTypeMethods methods;
+};
+
+struct MockValue {
+  int type = REDISMODULE_KEYTYPE_EMPTY;
+  std::deque<std::string> list;
+  RedisModuleType *mt = NULL;
+  void *mv = NULL;
+};
+
+std::unordered_map<std::string,MockValue> mockDb;
+
+struct RedisModuleKey {
+  std::string name;
+};
+
+struct RedisModuleCallReply {
+  int type;
+  long long integer;
+  std::string str;
+  std::vector<RedisModuleCallReply> elements;
+};
+
+std::unordered_map<std::string,RedisModuleCmdFunc> mockCommands;
+
+/* Memory */
+
+void *MockAlloc(size_t n) { mockAllocs++; return malloc(n); }
+void *MockCalloc(size_t n, size_t size) { mockAllocs++; return calloc(n,size); }
+void *MockRealloc(void *p, size_t n) { mockAllocs++; return realloc(p,n); }
+void MockFree(void *p) { free(p); }
+
+/* Strings */
+
+RedisModuleString *MockCreateString(RedisModuleCtx *ctx, const char *p, size_t len) {
+  mockAllocs++;
+  return new RedisModuleString{std::string(p,len)};
+}
+
+RedisModuleString *MockCreateStringFromLongLong(RedisModuleCtx *ctx, long long ll) {
+  mockAllocs++;
+  return new RedisModuleString{std::to_string(ll)};
+}
+
+RedisModuleString *MockCreateStringPrintf(RedisModuleCtx *ctx, const char *fmt, ...) {
+  char buf[1024];
+  va_list ap;
+  va_start(ap,fmt);
+  int n = vsnprintf(buf,sizeof(buf),fmt,ap);
+  va_end(ap);
+  mockAllocs += 3;
+  return new RedisModuleString{std::string(buf,n)};
+}
+
+void MockFreeString(RedisModuleCtx *ctx, RedisModuleString *s) { delete s; }
+
+const char *MockStringPtrLen(const RedisModuleString *s, size_t *len) {
+  if (len) *len = s->s.size();
+  return s->s.data();
+}
+
+int MockStringToLongLong(const RedisModuleString *s, long long *ll) {
+  const char *end = s->s.data()+s->s.size();
+  auto r = std::from_chars(s->s.data(),end,*ll);
+  return r.ec == std::errc() && r.ptr == end && !s->s.empty() ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+int MockStringToDouble(const RedisModuleString *s, double *d) {
+  char *end;
+  if (s->s.empty() || isspace((unsigned char) s->s[0])) return REDISMODULE_ERR;
+  *d = strtod(s->s.c_str(),&end);
+  return *end == '\0' && !std::isnan(*d) ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+/* Replies, formatted as RESP and counted */
+
+void MockReply(const char *p, size_t len) { mockReplyBytes += len; }
+
+void MockReplyHeader(char c, long long n) {
+  char buf[32];
+  buf[0] = c;
+  char *end = std::to_chars(buf+1,buf+sizeof(buf)-2,n).ptr;
+  MockReply(buf,end-buf+2);
+}
+
+int MockReplyWithLongLong(RedisModuleCtx *ctx, long long ll) {
+  MockReplyHeader(':',ll);
+  return REDISMODULE_OK;
+}
+
+int MockReplyWithStringBuffer(RedisModuleCtx *ctx, const char *p, size_t len) {
+  MockReplyHeader('$',len);
+  MockReply(p,len+2);
+  return REDISMODULE_OK;
+}
+
+/* Redis 5 sends doubles as bulk strings made with %.17g */
+int MockReplyWithDouble(RedisModuleCtx *ctx, double d) {
+  char buf[128];
+  int n = snprintf(buf,sizeof(buf),"%.17g",d);
+  return MockReplyWithStringBuffer(ctx,buf,n);
+}
+
+int MockReplyWithSimpleString(RedisModuleCtx *ctx, const char *s) {
+  MockReply(s,strlen(s)+3);
+  return REDISMODULE_OK;
+}
+
+int MockReplyWithError(RedisModuleCtx *ctx, const char *err) {
+  mockError = err;
+  MockReply(err,strlen(err)+3);
+  return REDISMODULE_OK;
+}
+
+int MockReplyWithArray(RedisModuleCtx *ctx, long len) {
+  MockReplyHeader('*',len);
+  return REDISMODULE_OK;
+}
+
+int MockReplyWithNull(RedisModuleCtx *ctx) {
+  MockReply("$-1\r\n",5);
+  return REDISMODULE_OK;
+}
+
+int MockWrongArity(RedisModuleCtx *ctx) {
+  return MockReplyWithError(ctx,"ERR wrong number of arguments");
+}
+
+/* Keys */
+
+void *MockOpenKey(RedisModuleCtx *ctx, RedisModuleString *keyname, int mode) {
+  return new RedisModuleKey{keyname->s};
+}
+
+void MockCloseKey(RedisModuleKey *key) {
+  auto it = mockDb.find(key->name);
+  if (it != mockDb.end() && it->second.type == REDISMODULE_KEYTYPE_LIST &&
+      it->second.list.empty())
+    mockDb.erase(it);
+  delete key;
+}
+
+int MockKeyType(RedisModuleKey *key) {
+  auto it = mockDb.find(key->name);
+  return it == mockDb.end() ? REDISMODULE_KEYTYPE_EMPTY : it->second.type;
+}
+
+size_t MockValueLength(RedisModuleKey *key) {
+  auto it = mockDb.find(key->name);
+  return it == mockDb.end() ? 0 : it->second.list.size();
+}
+
+int MockListPush(RedisModuleKey *key, int where, RedisModuleString *ele) {
+  MockValue &v = mockDb[key->name];
+  if (v.type == REDISMODULE_KEYTYPE_EMPTY) v.type = REDISMODULE_KEYTYPE_LIST;
+  if (v.type != REDISMODULE_KEYTYPE_LIST) return REDISMODULE_ERR;
+  if (where == REDISMODULE_LIST_HEAD) v.list.push_front(ele->s);
+  else v.list.push_back(ele->s);
+  return REDISMODULE_OK;
+}
+
+void MockDelete(const std::string &name) {
+  auto it = mockDb.find(name);
+  if (it == mockDb.end()) return;
+  if (it->second.mt) it->second.mt->methods.free(it->second.mv);
+  mockDb.erase(it);
+}
+
+RedisModuleType *MockCreateDataType(RedisModuleCtx *ctx, const char *name, int encver, RedisModuleTypeMethods *tm) {
+  return new RedisModuleType{*tm};
+}
+
+int MockModuleTypeSetValue(RedisModuleKey *key, RedisModuleType *mt, void *value) {
+  MockDelete(key->name);
+  MockValue &v = mockDb[key->name];
+  v.type = REDISMODULE_KEYTYPE_MODULE;
+  v.mt = mt;
+  v.mv = value;
+  return REDISMODULE_OK;
+}
+
+RedisModuleType *MockModuleTypeGetType(RedisModuleKey *key) {
+  auto it = mockDb.find(key->name);
+  return it == mockDb.end() ? NULL : it->second.mt;
+}
+
+void *MockModuleTypeGetValue(RedisModuleKey *key) {
+  auto it = mockDb.find(key->name);
+  return it == mockDb.end() ? NULL : it->second.mv;
+}
+
+/* RedisModule_Call, for LRANGE and LLEN */
+
+RedisModuleCallReply *MockCall(RedisModuleCtx *ctx, const char *cmd, const char *fmt, ...) {
+  std::vector<std::string> args;
+  va_list ap;
+  va_start(ap,fmt);
+  for (const char *f=fmt; *f; f++)
+  {
+    if (*f == 's') args.push_back(va_arg(ap,RedisModuleString *)->s);
+    else if (*f == 'c') args.push_back(va_arg(ap,const char *));
+    else if (*f == 'l') args.push_back(std::to_string(va_arg(ap,long long)));
+  }
+  va_end(ap);
+
+  RedisModuleCallReply *reply = new RedisModuleCallReply{REDISMODULE_REPLY_ERROR,0,"ERR unsupported",{}};
+  auto it = mockDb.find(args.empty() ? "" : args[0]);
+  bool list = it != mockDb.end() && it->second.type == REDISMODULE_KEYTYPE_LIST;
+  if (it != mockDb.end() && !list)
+    reply->str = REDISMODULE_ERRORMSG_WRONGTYPE;
+  else if (!strcasecmp(cmd,"LLEN") && args.size() == 1)
+  {
+    reply->type = REDISMODULE_REPLY_INTEGER;
+    reply->integer = list ? it->second.list.size() : 0;
+  }
+  else if (!strcasecmp(cmd,"LRANGE") && args.size() == 3)
+  {
+    reply->type = REDISMODULE_REPLY_ARRAY;
+    long long len = list ? it->second.list.size() : 0;
+    long long start = atoll(args[1].c_str()), stop = atoll(args[2].c_str());
+    if (start < 0) start = std::max(0LL,start+len);
+    if (stop < 0) stop += len;
+    if (stop >= len) stop = len-1;
+    for (long long i=start; i <= stop; i++)
+      reply->elements.push_back({REDISMODULE_REPLY_STRING,0,it->second.list[i],{}});
+  }
+  return reply;
+}
+
+int MockCallReplyType(RedisModuleCallReply *reply) {
+  return reply ? reply->type : REDISMODULE_REPLY_UNKNOWN;
+}
+
+long long MockCallReplyInteger(RedisModuleCallReply *reply) { return reply->integer; }
+
+size_t MockCallReplyLength(RedisModuleCallReply *reply) {
+  return reply->type == REDISMODULE_REPLY_ARRAY ? reply->elements.size() : reply->str.size();
+}
+
+RedisModuleCallReply *MockCallReplyArrayElement(RedisModuleCallReply *reply, size_t i) {
+  return i < reply->elements.size() ? &reply->elements[i] : NULL;
+}
+
+const char *MockCallReplyStringPtr(RedisModuleCallReply *reply, size_t *len) {
+  *len = reply->str.size();
+  return reply->str.data();
+}
+
+void MockFreeCallReply(RedisModuleCallReply *reply) { delete reply; }
+
+/* Everything else the commands touch */
+
+int MockCreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc f, const char *flags, int firstkey, int lastkey, int step) {
+  mockCommands[name] = f;
+  return REDISMODULE_OK;
+}
+
+void MockSetModuleAttribs(RedisModuleCtx *ctx, const char *name, int ver, int apiver) {}
+int MockGetSelectedDb(RedisModuleCtx *ctx) { return 0; }
+int MockGetContextFlags(RedisModuleCtx *ctx) { return REDISMODULE_CTX_FLAGS_MASTER; }
+int MockReplicate(RedisModuleCtx *ctx, const char *cmd, const char *fmt, ...) { return REDISMODULE_OK; }
+int MockReplicateVerbatim(RedisModuleCtx *ctx) { return REDISMODULE_OK; }
+int MockIsKeysPositionRequest(RedisModuleCtx *ctx) { return 0; }
+void MockKeyAtPos(RedisModuleCtx *ctx, int pos) {}
+int MockSubscribeToKeyspaceEvents(RedisModuleCtx *ctx, int types, RedisModuleNotificationFunc cb) { return REDISMODULE_OK; }
+
+void MockLog(RedisModuleCtx *ctx, const char *level, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap,fmt);
+  vfprintf(stderr,fmt,ap);
+  va_end(ap);
+  fputc('\n',stderr);
+}
+
+std::unordered_map<std::string,void *> mockApi = {
+#define MOCK_API(name) {"RedisModule_" #name, (void *) Mock##name}
+  MOCK_API(Alloc), MOCK_API(Calloc), MOCK_API(Realloc), MOCK_API(Free),
+  MOCK_API(CreateString), MOCK_API(CreateStringFromLongLong),
+  MOCK_API(CreateStringPrintf), MOCK_API(FreeString), MOCK_API(StringPtrLen),
+  MOCK_API(StringToLongLong), MOCK_API(StringToDouble),
+  MOCK_API(ReplyWithLongLong), MOCK_API(ReplyWithStringBuffer),
+  MOCK_API(ReplyWithDouble), MOCK_API(ReplyWithSimpleString),
+  MOCK_API(ReplyWithError), MOCK_API(ReplyWithArray), MOCK_API(ReplyWithNull),
+  MOCK_API(WrongArity), MOCK_API(OpenKey), MOCK_API(CloseKey),
+  MOCK_API(KeyType), MOCK_API(ValueLength), MOCK_API(ListPush),
+  MOCK_API(CreateDataType), MOCK_API(ModuleTypeSetValue),
+  MOCK_API(ModuleTypeGetType), MOCK_API(ModuleTypeGetValue),
+  MOCK_API(Call), MOCK_API(CallReplyType), MOCK_API(CallReplyInteger),
+  MOCK_API(CallReplyLength), MOCK_API(CallReplyArrayElement),
+  MOCK_API(CallReplyStringPtr), MOCK_API(FreeCallReply),
+  MOCK_API(CreateCommand), MOCK_API(SetModuleAttribs),
+  MOCK_API(GetSelectedDb), MOCK_API(GetContextFlags), MOCK_API(Replicate),
+  MOCK_API(ReplicateVerbatim), MOCK_API(SubscribeToKeyspaceEvents),
+  MOCK_API(IsKeysPositionRequest), MOCK_API(KeyAtPos), MOCK_API(Log),
+#undef MOCK_API
+};
+
+int MockGetApi(const char *name, void *pp) {
+  auto it = mockApi.find(name);
+  if (it == mockApi.end()) return REDISMODULE_ERR;
+  *(void **) pp = it->second;
+  return REDISMODULE_OK;
+}
+
+RedisModuleCtx mockCtx = {(void *) MockGetApi};
+
+/* Loads the module with the given arguments */
+void MockLoad(std::vector<const char *> args) {
+  std::vector<RedisModuleString *> argv;
+  for (const char *a : args)
+    argv.push_back(new RedisModuleString{a});
+  if (RedisModule_OnLoad(&mockCtx,argv.data(),argv.size()) != REDISMODULE_OK)
+  {
+    fprintf(stderr,"Module failed to load\n");
+    exit(1);
+  }
+  for (RedisModuleString *s : argv) delete s;
+}
+
+/* Runs a command as a client would, returning 0 if it replied an error */
+int MockRun(std::vector<std::string> args) {
+  std::vector<RedisModuleString *> argv;
+  for (const std::string &a : args)
+    argv.push_back(new RedisModuleString{a});
+  mockError.clear();
+  auto it = mockCommands.find(args[0]);
+  if (it == mockCommands.end())
+    mockError = "ERR unknown command";
+  else
+    it->second(&mockCtx,argv.data(),argv.size());
+  for (RedisModuleString *s : argv) delete s;
+  return mockError.empty();
+}
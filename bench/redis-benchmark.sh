@@ -0,0 +1,56 @@
+#!/bin/sh
+# End to end numbers against a running server with Random.so loaded:
+#   redis-server --loadmodule ./Random.so
+#   ./bench/redis-benchmark.sh [-h host] [-p port] [-n requests]
+# Keys made here are named bench:* and are deleted at the end.
+
+HOST=127.0.0.1
+PORT=6379
+N=100000
+while getopts h:p:n: opt; do
+  case $opt in
+    h) HOST=$OPTARG ;;
+    p) PORT=$OPTARG ;;
+    n) N=$OPTARG ;;
+    *) exit 1 ;;
+  esac
+done
+
+bench() {
+  redis-benchmark -h "$HOST" -p "$PORT" -q "$@"
+}
+
+cli() {
+  redis-cli -h "$HOST" -p "$PORT" "$@"
+}
+
+echo "Single randoms"
+bench -n "$N" random.norm 0 1
+bench -n "$N" random.unif 0 1
+bench -n "$N" random.dunif 1 6
+bench -n "$N" random.exp 1
+
+echo "Bulk replies"
+for c in 100 10000; do
+  bench -n $((N/c*10+10)) random.norm 0 1 COUNT $c
+  bench -n $((N/c*10+10)) random.dunif 1 6 COUNT $c
+done
+
+echo "Fills of 1000 samples into random keys"
+bench -n $((N/10)) -r 1000 random.lnorm bench:__rand_int__ 1000
+bench -n $((N/10)) -r 1000 random.lnorm bench:p:__rand_int__ 1000 0 1 PACKED
+
+echo "Histograms of 1M samples"
+cli random.lnorm bench:hist 1000000 > /dev/null
+cli random.lnorm bench:hist:p 1000000 0 1 PACKED > /dev/null
+bench -n 100 random.hist bench:hist 100
+bench -n 100 random.hist bench:hist 100 MIN -5 MAX 5
+bench -n 1000 random.hist bench:hist:p 100
+bench -n 1000 random.hist bench:hist:p 100 MIN -5 MAX 5
+
+echo "PING latency while replying with 10M samples"
+cli random.norm 0 1 COUNT 10000000 > /dev/null &
+bench -n 10000 -c 1 -t ping_inline
+wait
+
+cli --scan --pattern 'bench:*' | xargs -r redis-cli -h "$HOST" -p "$PORT" del > /dev/null
@@ -0,0 +1,75 @@
+/* Sampler throughput: the std distributions rebuilt per sample, as the
+ * commands used to do, against the ziggurat fills on every engine.
+ * The module source is compiled in directly, no Redis involved. */
+#include "../Random.cc"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#define BENCH_SAMPLES 10000000
+
+double sink;
+
+template <class F>
+void Report(const char *name, F f) {
+  auto t0 = std::chrono::steady_clock::now();
+  f();
+  auto t1 = std::chrono::steady_clock::now();
+  double s = std::chrono::duration<double>(t1-t0).count();
+  printf("%-34s %8.2f Msamples/s %7.2f ns/sample\n", name,
+         BENCH_SAMPLES/s/1e6, s*1e9/BENCH_SAMPLES);
+}
+
+int main() {
+#ifdef HAVE_X86_SIMD
+  HaveAVX2 = __builtin_cpu_supports("avx2");
+#endif
+  ZigguratInit();
+  for (Engine *e : Engines) e->reseed(1);
+  std::vector<double> buf(SAMPLE_BATCH);
+
+  Report("normal std per call (mt19937)", [&] {
+    for (long i=0; i < BENCH_SAMPLES; i++)
+    {
+      std::normal_distribution<double> rnorm(0.0,1.0);
+      sink += rnorm(gen);
+    }
+  });
+  Report("normal std reused (mt19937)", [&] {
+    std::normal_distribution<double> rnorm(0.0,1.0);
+    for (long i=0; i < BENCH_SAMPLES; i++) sink += rnorm(gen);
+  });
+  for (Engine *e : Engines)
+  {
+    char name[64];
+    snprintf(name,sizeof(name),"normal ziggurat (%s)",e->name);
+    Report(name, [&] {
+      for (long i=0; i < BENCH_SAMPLES; i += SAMPLE_BATCH)
+      {
+        NormalFill(*e,buf.data(),SAMPLE_BATCH,0.0,1.0);
+        sink += buf[0];
+      }
+    });
+  }
+
+  Report("exponential std per call (mt19937)", [&] {
+    for (long i=0; i < BENCH_SAMPLES; i++)
+    {
+      std::exponential_distribution<double> rexp(1.0);
+      sink += rexp(gen);
+    }
+  });
+  for (Engine *e : Engines)
+  {
+    char name[64];
+    snprintf(name,sizeof(name),"exponential ziggurat (%s)",e->name);
+    Report(name, [&] {
+      for (long i=0; i < BENCH_SAMPLES; i += SAMPLE_BATCH)
+      {
+        ExpFill(*e,buf.data(),SAMPLE_BATCH,1.0);
+        sink += buf[0];
+      }
+    });
+  }
+  return sink == 42.0;
+}